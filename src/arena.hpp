@@ -0,0 +1,223 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+
+// Author: Bo Han
+#ifndef arena_hpp
+#define arena_hpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/* growable output buffer; every append makes room for itself first, growing the buffer geometrically,
+ * so records of any length fit and the buffer is reused at its largest size once it is cleared
+ * */
+class OutputArena
+{
+public:
+    constexpr static size_t min_capacity = 1 << 16;
+
+    /* buffers of this size and larger are aligned to it, to be backed by huge pages, see hugePages() */
+    constexpr static size_t huge_page_size = 2 << 20;
+
+    /* whether large buffers are backed by transparent huge pages where the kernel has them, so that the
+     * batches, which are reused, take fewer TLB entries; off by default */
+    static bool &hugePages()
+    {
+        static bool on = false;
+        return on;
+    }
+
+    OutputArena() = default;
+
+    OutputArena(OutputArena &&other)
+        : buf_(other.buf_), size_(other.size_), capacity_(other.capacity_)
+    {
+        other.buf_ = nullptr;
+        other.size_ = other.capacity_ = 0;
+    }
+
+    OutputArena &operator=(OutputArena &&other)
+    {
+        std::swap(buf_, other.buf_);
+        std::swap(size_, other.size_);
+        std::swap(capacity_, other.capacity_);
+        return *this;
+    }
+
+    OutputArena(const OutputArena &) = delete;
+
+    OutputArena &operator=(const OutputArena &) = delete;
+
+    ~OutputArena()
+    {
+        free(buf_);
+    }
+
+    void reserve(size_t n)
+    {
+        if (n > capacity_) {
+            grow(n);
+        }
+    }
+
+    /* room for n more chars at the end, to be taken with commit() */
+    char *room(size_t n)
+    {
+        reserve(size_ + n);
+        return buf_ + size_;
+    }
+
+    void commit(size_t n)
+    {
+        size_ += n;
+    }
+
+    void append(const char *p, size_t n)
+    {
+        memcpy(room(n), p, n);
+        size_ += n;
+    }
+
+    /* string literals, without the terminating nul */
+    template<size_t N>
+    void append(const char (&s)[N])
+    {
+        append(s, N - 1);
+    }
+
+    /* anything with data() and size(), e.g. std::string and caseInsensitiveString */
+    template<class S>
+    void append(const S &s)
+    {
+        append(s.data(), s.size());
+    }
+
+    void append(char c)
+    {
+        *room(1) = c;
+        ++size_;
+    }
+
+    /* v in decimal */
+    void appendNumber(uint64_t v)
+    {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        char *p = room(n);
+        for (size_t i = 0; i < n; ++i) {
+            p[i] = digits[n - 1 - i];
+        }
+        size_ += n;
+    }
+
+    /* drop the first n chars */
+    void consume(size_t n)
+    {
+        memmove(buf_, buf_ + n, size_ - n);
+        size_ -= n;
+    }
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+    const char *data() const
+    {
+        return buf_;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    bool empty() const
+    {
+        return !size_;
+    }
+
+private:
+    void grow(size_t n)
+    {
+        size_t capacity = std::max(n, capacity_ * 2);
+        if (capacity < min_capacity) {
+            capacity = min_capacity;
+        }
+        char *buf;
+        if (hugePages() && capacity >= huge_page_size) {
+            capacity = (capacity + huge_page_size - 1) / huge_page_size * huge_page_size;
+            void *p = nullptr;
+            buf = posix_memalign(&p, huge_page_size, capacity) ? nullptr : static_cast<char *>(p);
+            if (buf) {
+                memcpy(buf, buf_, size_);
+                free(buf_);
+#ifdef MADV_HUGEPAGE
+                madvise(buf, capacity, MADV_HUGEPAGE);
+#endif
+            }
+        } else {
+            buf = static_cast<char *>(realloc(buf_, capacity));
+        }
+        if (!buf) {
+            fprintf(stderr, "Error: out of memory for %zu bytes of output\n", capacity);
+            exit(EXIT_FAILURE);
+        }
+        buf_ = buf;
+        capacity_ = capacity;
+    }
+
+    char *buf_ = nullptr;
+    size_t size_ = 0;
+    size_t capacity_ = 0;
+};
+
+#endif /* arena_hpp */
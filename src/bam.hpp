@@ -0,0 +1,457 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#ifndef bam_hpp
+#define bam_hpp
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include "bgzf.hpp"
+#include "fastq.hpp"
+#include "sequence.hpp"
+#include "type_policy.h"
+#include "kernel_color.h"
+
+/* unaligned BAM record, as PacBio flnc.bam/ccs.bam */
+template<class T = caseInsensitiveString>
+struct Bam: public Sequence<T>
+{
+    using seq_type = Sequence<T>;
+    std::string name_;
+    std::string quality_; // phred + 33 as in fastq; empty if the record has none
+    uint16_t flag_ = 0;
+    std::string aux_; // raw optional fields (tags)
+};
+
+constexpr char k_bam_magic[] = "BAM\1";
+
+/* size of the fixed-length part of a BAM record, block_size excluded */
+constexpr size_t k_bam_core_size = 32;
+
+inline int32_t bamInt32(const char *p)
+{
+    int32_t v;
+    memcpy(&v, p, 4); // BAM is little-endian, as are the machines we run on
+    return v;
+}
+
+inline uint16_t bamUInt16(const char *p)
+{
+    uint16_t v;
+    memcpy(&v, p, 2);
+    return v;
+}
+
+/* whether the read name, cigar, sequence and quality of the record at r, of block_size bytes after the size
+ * itself, lie within it */
+inline bool bamRecordFits(const char *r, int32_t block_size)
+{
+    if (block_size < static_cast<int32_t>(k_bam_core_size)) return false;
+    const int64_t l_seq = bamInt32(r + 16);
+    if (l_seq < 0) return false;
+    const int64_t used = k_bam_core_size + static_cast<unsigned char>(r[8]) + 4 * int64_t(bamUInt16(r + 12)) +
+                         (l_seq + 1) / 2 + l_seq;
+    return used <= block_size;
+}
+
+/* 4-bit encoded nucleotides, two of them per byte */
+struct BamSeqTable
+{
+    BamSeqTable()
+    {
+        const char *nt16 = "=ACMGRSVTWYHKDBN";
+        for (int i = 0; i < 256; ++i) {
+            pairs[i][0] = nt16[i >> 4];
+            pairs[i][1] = nt16[i & 15];
+        }
+    }
+
+    char pairs[256][2];
+};
+
+/* nucleotides to their 4-bit code */
+struct BamNt16Table
+{
+    BamNt16Table()
+    {
+        const char *nt16 = "=ACMGRSVTWYHKDBN";
+        memset(codes, 15, sizeof(codes));
+        for (int i = 0; i < 16; ++i) {
+            codes[static_cast<unsigned char>(nt16[i])] = i;
+            codes[static_cast<unsigned char>(tolower(nt16[i]))] = i;
+        }
+    }
+
+    unsigned char codes[256];
+};
+
+/* header of an unaligned BAM file written from fastq/fasta input */
+inline std::string unalignedBamHeader()
+{
+    const std::string text = "@HD\tVN:1.5\tSO:unknown\n";
+    std::string header{k_bam_magic, 4};
+    int32_t l_text = text.size(), n_ref = 0;
+    header.append(reinterpret_cast<const char *>(&l_text), 4);
+    header += text;
+    header.append(reinterpret_cast<const char *>(&n_ref), 4);
+    return header;
+}
+
+/* size of the value of an optional field of type t, 0 for variable-length types */
+inline size_t bamAuxValueSize(char t)
+{
+    switch (t) {
+        case 'A': case 'c': case 'C': return 1;
+        case 's': case 'S': return 2;
+        case 'i': case 'I': case 'f': return 4;
+        default: return 0;
+    }
+}
+
+/* append the optional fields in [b, e) to out, except those tagged with tag */
+inline void bamAuxAppendExcept(const char *b, const char *e, const char *tag, std::string &out)
+{
+    while (e - b >= 3) {
+        const char *field = b;
+        char t = b[2];
+        b += 3;
+        if (t == 'Z' || t == 'H') {
+            b = static_cast<const char *>(memchr(b, '\0', e - b));
+            b = b ? b + 1 : e;
+        } else if (t == 'B') {
+            const int64_t count = e - b < 5 ? -1 : bamInt32(b + 1);
+            const size_t size = e - b < 5 ? 0 : bamAuxValueSize(b[0]);
+            if (count < 0 || !size || count * size > static_cast<uint64_t>(e - b - 5)) {
+                fprintf(stderr, "Error: ill-formatted array in the optional field %.2s of a BAM record\n", field);
+                exit(EXIT_FAILURE);
+            }
+            b += 5 + count * size;
+        } else {
+            if (!bamAuxValueSize(t) || static_cast<size_t>(e - b) < bamAuxValueSize(t)) {
+                fprintf(stderr, "Error: ill-formatted optional field %.2s of a BAM record\n", field);
+                exit(EXIT_FAILURE);
+            }
+            b += bamAuxValueSize(t);
+        }
+        if (field[0] != tag[0] || field[1] != tag[1]) {
+            out.append(field, b);
+        }
+    }
+}
+
+/* tag of the length of the trimmed polyA tail in BAM output */
+constexpr char k_bam_polya_tag[] = "pA";
+
+/* optional fields of the input record; only BAM input has any */
+template<class R>
+std::pair<const char *, const char *> bamAux(const R &)
+{
+    return {nullptr, nullptr};
+}
+
+template<class T>
+std::pair<const char *, const char *> bamAux(const Bam<T> &bam)
+{
+    return {bam.aux_.data(), bam.aux_.data() + bam.aux_.size()};
+}
+
+/* qualities of the input record and their #, which may be left in its block; fasta has none */
+template<class R>
+std::pair<const char *, size_t> bamQuality(const R &)
+{
+    return {nullptr, 0};
+}
+
+template<class T>
+std::pair<const char *, size_t> bamQuality(const Fastq<T> &fq)
+{
+    return {fq.qualityData(), fq.qualitySize()};
+}
+
+template<class T>
+std::pair<const char *, size_t> bamQuality(const Bam<T> &bam)
+{
+    return {bam.quality_.data(), bam.quality_.size()};
+}
+
+template<class R>
+uint16_t bamFlag(const R &)
+{
+    return 4; // unmapped
+}
+
+template<class T>
+uint16_t bamFlag(const Bam<T> &bam)
+{
+    return bam.flag_;
+}
+
+/* longest read name BAM takes, its NUL excluded */
+constexpr size_t k_bam_max_name_size = 254;
+
+/* # of characters of name written as a BAM read name: up to its first whitespace, as a read name cannot have any,
+ * e.g. the description of a fastq header, and no more than k_bam_max_name_size, with a warning */
+inline size_t bamNameSize(const char *name, size_t n)
+{
+    size_t k = 0;
+    while (k < n && !isspace(static_cast<unsigned char>(name[k]))) {
+        ++k;
+    }
+    if (k > k_bam_max_name_size) {
+        fprintf(stderr, "[warning] read name %.*s... is longer than BAM takes, cut to %zu characters\n",
+                static_cast<int>(k_bam_max_name_size), name, k_bam_max_name_size);
+        k = k_bam_max_name_size;
+    }
+    return k;
+}
+
+/* writing policy of unaligned BAM records, for any input record with name_ and seq_ (and quality_) */
+template<class R>
+struct bam_write_policy
+{
+    // append rec without its last trimmed nucleotides to out, encoded and tagged with the polyA length
+    static void write(OutputArena &out, const R &rec, size_t trimmed)
+    {
+        static const BamNt16Table table;
+        const size_t l_seq = rec.seq_.size() - trimmed;
+        const size_t name_size = bamNameSize(rec.name_.data(), rec.name_.size());
+        const size_t l_read_name = name_size + 1;
+        std::string aux;
+        auto range = bamAux(rec);
+        bamAuxAppendExcept(range.first, range.second, k_bam_polya_tag, aux);
+        const size_t size = 4 + k_bam_core_size + l_read_name + (l_seq + 1) / 2 + l_seq + aux.size() + 7;
+        char *buf = out.room(size);
+        char *p = buf + 4; // block_size filled in the end
+        int32_t core[8] = {-1 /* refID */, -1 /* pos */, 0, 0, static_cast<int32_t>(l_seq), -1, -1, 0};
+        core[2] = static_cast<int32_t>(l_read_name | (255 << 8) | (4680 << 16)); // l_read_name, mapq, bin
+        core[3] = static_cast<int32_t>(uint32_t(bamFlag(rec)) << 16); // n_cigar_op = 0, flag
+        memcpy(p, core, k_bam_core_size);
+        p += k_bam_core_size;
+        memcpy(p, rec.name_.data(), name_size);
+        p[name_size] = '\0';
+        p += l_read_name;
+        const unsigned char *s = reinterpret_cast<const unsigned char *>(rec.seq_.data());
+        for (size_t i = 0; i + 1 < l_seq; i += 2) {
+            *p++ = (table.codes[s[i]] << 4) | table.codes[s[i + 1]];
+        }
+        if (l_seq & 1) {
+            *p++ = table.codes[s[l_seq - 1]] << 4;
+        }
+        const auto quality = bamQuality(rec);
+        if (quality.second && quality.second >= l_seq) { // a quality shorter than the sequence is taken as missing
+            for (size_t i = 0; i < l_seq; ++i) {
+                p[i] = quality.first[i] - 33;
+            }
+        } else {
+            memset(p, 0xff, l_seq);
+        }
+        p += l_seq;
+        memcpy(p, aux.data(), aux.size());
+        p += aux.size();
+        int32_t len = static_cast<int32_t>(trimmed);
+        memcpy(p, k_bam_polya_tag, 2);
+        p[2] = 'i';
+        memcpy(p + 3, &len, 4);
+        int32_t block_size = static_cast<int32_t>(size - 4);
+        memcpy(buf, &block_size, 4);
+        out.commit(size);
+    }
+};
+
+/* read the header (magic, text and references) off reader into header; return false if it is not BAM */
+inline bool readBamHeader(BgzfBlockReader &reader, std::string &header)
+{
+    std::string s;
+    if (!reader.read(s, 8) || s.compare(0, 4, k_bam_magic, 4) != 0) return false;
+    header = s;
+    if (!reader.read(s, bamInt32(header.data() + 4) + 4)) return false; // text and n_ref
+    header += s;
+    for (int32_t n_ref = bamInt32(header.data() + header.size() - 4); n_ref > 0; --n_ref) {
+        if (!reader.read(s, 4)) return false;
+        header += s;
+        if (!reader.read(s, bamInt32(s.data()) + 4)) return false; // name and l_ref
+        header += s;
+    }
+    return true;
+}
+
+/* reading policy, blocks of BAM records come from BgzfBlockReader */
+template<class T>
+struct read_policy<Bam<T> >
+{
+    using bam_type = Bam<T>;
+
+    // reading policy for BAM records in a memory block; p is moved to the next record
+    // the quality is only decoded if fields has k_field_quality; it is always owned
+    static bam_type read(const char *&p, const char *e, unsigned fields = k_all_fields)
+    {
+        bam_type bam{};
+        read(bam, p, e, fields);
+        return bam;
+    }
+
+    // as above, into bam, a record read before, reusing the capacity of its strings
+    static void read(bam_type &bam, const char *&p, const char *e, unsigned fields = k_all_fields)
+    {
+        static const BamSeqTable table;
+        bam.quality_.clear();
+        if (e - p < 4 || e - p - 4 < bamInt32(p) || !bamRecordFits(p + 4, bamInt32(p))) { // see scan
+            p = e;
+            bam.name_.clear();
+            bam.seq_.clear();
+            bam.flag_ = 0;
+            bam.aux_.clear();
+            return;
+        }
+        const char *r = p + 4;
+        p = r + bamInt32(p);
+        const size_t l_read_name = static_cast<unsigned char>(r[8]);
+        const size_t n_cigar_op = bamUInt16(r + 12);
+        bam.flag_ = bamUInt16(r + 14);
+        const size_t l_seq = bamInt32(r + 16);
+        r += k_bam_core_size;
+        bam.name_.assign(r, l_read_name ? l_read_name - 1 : 0); // NUL terminated
+        r += l_read_name + 4 * n_cigar_op;
+        /* decode the packed sequence a byte, i.e. two nucleotides, at a time
+         * straight into the characters the HMM takes through to_idx */
+        bam.seq_.resize(l_seq);
+        const unsigned char *packed = reinterpret_cast<const unsigned char *>(r);
+        for (size_t i = 0; i < l_seq / 2; ++i) {
+            memcpy(&bam.seq_[2 * i], table.pairs[packed[i]], 2);
+        }
+        if (l_seq & 1) {
+            bam.seq_[l_seq - 1] = table.pairs[packed[l_seq / 2]][0];
+        }
+        r += (l_seq + 1) / 2;
+        if ((fields & k_field_quality) && l_seq && static_cast<unsigned char>(r[0]) != 0xff) {
+            bam.quality_.resize(l_seq);
+            for (size_t i = 0; i < l_seq; ++i) {
+                bam.quality_[i] = r[i] + 33;
+            }
+        }
+        r += l_seq;
+        bam.aux_.assign(r, p);
+    }
+
+    // boundary scan: each record is prefixed by its size, see FormatBlockReader
+    static const char *scan(const char *b, const char *e, size_t &n, bool &eof)
+    {
+        size_t found = 0;
+        while (found < n && e - b >= 4) {
+            int32_t block_size = bamInt32(b);
+            if (block_size < static_cast<int32_t>(k_bam_core_size)) {
+                eof = true; // ill-formated file, stop here
+                break;
+            }
+            if (e - b - 4 < block_size) break; // incomplete record
+            if (!bamRecordFits(b + 4, block_size)) {
+                fprintf(stderr, "[warning] ill-formatted BAM record, its fields run past its size; stopping here\n");
+                eof = true;
+                break;
+            }
+            b += 4 + block_size;
+            ++found;
+        }
+        n = found;
+        return b;
+    }
+};
+
+/* writing policy, written as fastq, or as fasta if there is no quality */
+template<class T>
+struct write_policy<Bam<T> >
+{
+    using bam_type = Bam<T>;
+
+    // append bam, as fastq or fasta if it has no quality, without its last trimmed nucleotides to out
+    static void write(OutputArena &out, const bam_type &bam, size_t trimmed)
+    {
+        out.append(bam.quality_.empty() ? '>' : '@');
+        out.append(bam.name_);
+        out.append('\n');
+        out.append(bam.seq_.data(), bam.seq_.size() - trimmed);
+        out.append('\n');
+        if (!bam.quality_.empty()) {
+            out.append("+\n");
+            out.append(bam.quality_.data(), bam.quality_.size() - trimmed);
+            out.append('\n');
+        }
+    }
+
+    // append the slices of bam, as fastq or fasta, without its last trimmed nucleotides to iov
+    static void gather(std::vector<iovec> &iov, const bam_type &bam, size_t trimmed)
+    {
+        addSlice(iov, bam.quality_.empty() ? ">" : "@", 1);
+        addSlice(iov, bam.name_.data(), bam.name_.size());
+        addSlice(iov, "\n", 1);
+        addSlice(iov, bam.seq_.data(), bam.seq_.size() - trimmed);
+        if (bam.quality_.empty()) {
+            addSlice(iov, "\n", 1);
+            return;
+        }
+        addSlice(iov, "\n+\n", 3);
+        addSlice(iov, bam.quality_.data(), bam.quality_.size() - trimmed);
+        addSlice(iov, "\n", 1);
+    }
+
+    // append bam to out with its last trimmed nucleotides colored
+    static void writeColor(OutputArena &out, const bam_type &bam, size_t trimmed)
+    {
+        const size_t kept = bam.seq_.size() - trimmed;
+        out.append(bam.quality_.empty() ? '>' : '@');
+        out.append(bam.name_);
+        out.append('\n');
+        out.append(bam.seq_.data(), kept);
+        out.append(KERNAL_RED);
+        out.append(bam.seq_.data() + kept, trimmed);
+        if (bam.quality_.empty()) {
+            out.append("\n" KERNAL_RESET);
+            return;
+        }
+        const size_t qual_kept = bam.quality_.size() - trimmed;
+        out.append(KERNAL_RESET "\n+\n");
+        out.append(bam.quality_.data(), qual_kept);
+        out.append(KERNAL_RED);
+        out.append(bam.quality_.data() + qual_kept, trimmed);
+        out.append("\n" KERNAL_RESET);
+    }
+};
+
+#endif /* bam_hpp */
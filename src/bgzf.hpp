@@ -0,0 +1,337 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#ifndef bgzf_hpp
+#define bgzf_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <istream>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <condition_variable>
+#include "format.hpp"
+
+/* BGZF: a series of gzip members of at most 64 kb each, with the compressed size stored in the "BC" extra field.
+ * each block can be inflated on its own, which is what makes parallel decompression possible */
+constexpr size_t k_bgzf_header_size = 18;
+constexpr size_t k_bgzf_footer_size = 8;
+constexpr size_t k_bgzf_max_block_size = 1 << 16;
+
+/* total size of the block, header and footer included */
+inline size_t bgzfBlockSize(const char *h)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(h);
+    return (u[16] | (u[17] << 8)) + 1;
+}
+
+/* whether the 18 bytes in h are a BGZF block header, of a block that holds at least the header and footer */
+inline bool isBgzfHeader(const char *h)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(h);
+    return u[0] == 31 && u[1] == 139 && u[2] == 8 && (u[3] & 4) && u[10] == 6 && u[11] == 0
+        && u[12] == 'B' && u[13] == 'C' && u[14] == 2 && u[15] == 0
+        && bgzfBlockSize(h) >= k_bgzf_header_size + k_bgzf_footer_size;
+}
+
+/* inflate one complete BGZF block [b, b + n) and append the data to out; return false on corruption */
+inline bool inflateBgzfBlock(const char *b, size_t n, std::string &out)
+{
+    if (n < k_bgzf_header_size + k_bgzf_footer_size) return false;
+    const unsigned char *footer = reinterpret_cast<const unsigned char *>(b + n - k_bgzf_footer_size);
+    uint32_t crc = footer[0] | (footer[1] << 8) | (footer[2] << 16) | (uint32_t(footer[3]) << 24);
+    uint32_t isize = footer[4] | (footer[5] << 8) | (footer[6] << 16) | (uint32_t(footer[7]) << 24);
+    if (isize == 0) return true; // e.g. the EOF marker
+    if (isize > k_bgzf_max_block_size) return false;
+    size_t off = out.size();
+    out.resize(off + isize);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, -15) != Z_OK) return false; // raw deflate data
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(b + k_bgzf_header_size));
+    zs.avail_in = n - k_bgzf_header_size - k_bgzf_footer_size;
+    zs.next_out = reinterpret_cast<Bytef *>(&out[off]);
+    zs.avail_out = isize;
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END && zs.total_out == isize
+        && crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(out.data() + off), isize) == crc;
+}
+
+/* largest chunk of data compressed into a single block, as htslib does */
+constexpr size_t k_bgzf_block_data_size = 0xff00;
+
+/* the empty block marking the end of a BGZF file */
+constexpr char k_bgzf_eof[] = "\037\213\010\4\0\0\0\0\0\377\6\0\102\103\2\0\033\0\3\0\0\0\0\0\0\0\0\0";
+constexpr size_t k_bgzf_eof_size = sizeof(k_bgzf_eof) - 1;
+
+/* compress [b, b + n) into BGZF blocks appended to out */
+inline void compressBgzf(const char *b, size_t n, OutputArena &out)
+{
+    for (size_t off = 0; off < n; off += k_bgzf_block_data_size) {
+        size_t len = std::min(k_bgzf_block_data_size, n - off);
+        unsigned char *h = reinterpret_cast<unsigned char *>(out.room(k_bgzf_max_block_size));
+        const unsigned char header[k_bgzf_header_size] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 0, 0};
+        memcpy(h, header, k_bgzf_header_size);
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            fprintf(stderr, "Error: cannot initialize zlib\n");
+            exit(EXIT_FAILURE);
+        }
+        zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(b + off));
+        zs.avail_in = len;
+        zs.next_out = h + k_bgzf_header_size;
+        zs.avail_out = k_bgzf_max_block_size - k_bgzf_header_size - k_bgzf_footer_size;
+        int ret = deflate(&zs, Z_FINISH);
+        deflateEnd(&zs);
+        if (ret != Z_STREAM_END) { // incompressible data larger than the block, never happens with 0xff00 bytes
+            fprintf(stderr, "Error: cannot compress a BGZF block\n");
+            exit(EXIT_FAILURE);
+        }
+        size_t size = k_bgzf_header_size + zs.total_out + k_bgzf_footer_size;
+        h[16] = (size - 1) & 0xff;
+        h[17] = (size - 1) >> 8;
+        uint32_t crc = crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(b + off), len);
+        unsigned char *footer = h + size - k_bgzf_footer_size;
+        for (int i = 0; i < 4; ++i) {
+            footer[i] = (crc >> (8 * i)) & 0xff;
+            footer[4 + i] = (len >> (8 * i)) & 0xff;
+        }
+        out.commit(size);
+    }
+}
+
+/* whether file_name (or stdin for "stdin" and "-") is BGZF compressed;
+ * stdin can only be peeked for a single byte, and gzip on stdin is otherwise unsupported, so that is enough */
+inline bool isBgzfFile(const std::string &file_name)
+{
+    if (file_name == "stdin" || file_name == "-") {
+        std::ios::sync_with_stdio(false); // before peeking, switching it afterwards would drop the peeked byte
+        return std::cin.rdbuf()->sgetc() == 31;
+    }
+    char h[k_bgzf_header_size];
+    std::ifstream ifs{file_name, std::ios::binary};
+    return ifs.read(h, k_bgzf_header_size) && isBgzfHeader(h);
+}
+
+/* reader of BGZF compressed input handing out raw, record-aligned blocks of decompressed bytes
+ * next() is thread safe and done in three steps
+ * 1. under the read lock, a batch of compressed blocks is read and numbered
+ * 2. without any lock, the batch is inflated by the calling thread
+ * 3. in the order of the numbers, the data is appended to what the previous batch left; complete records
+ *    (read_policy<T>::scan, see FormatBlockReader) are handed out and the incomplete tail kept for the next batch
+ * */
+class BgzfBlockReader
+{
+public:
+    /* # of BGZF blocks, i.e. at most 64 kb each, in a batch */
+    constexpr static size_t blocks_per_batch = 16;
+
+    explicit BgzfBlockReader(const std::string &file_name, IoBackendKind io = IoBackendKind::STREAM)
+    {
+        openRawStream(file_name, ins_, io);
+    }
+
+    /* only the records of a shard of the BGZF file file_name, see shard.hpp */
+    BgzfBlockReader(const std::string &file_name, IoBackendKind io, const ShardRange &range)
+        : skip_(range.skip), drop_(range.drop)
+    {
+        openRawRange(file_name, ins_, io, range.begin, range.end);
+    }
+
+    BgzfBlockReader(const BgzfBlockReader &) = delete;
+
+    BgzfBlockReader &operator=(const BgzfBlockReader &) = delete;
+
+    /* first byte of the remaining decompressed input, EOF if there is none; NOT thread safe */
+    int peek()
+    {
+        while (carry_.empty() && !eof_) {
+            std::string compressed, inflated;
+            readBatch(compressed, 1);
+            inflateBatch(compressed, inflated);
+            splice(inflated, eof_);
+        }
+        return carry_.empty() ? EOF : static_cast<unsigned char>(carry_[0]);
+    }
+
+    /* consume n bytes of decompressed input into s, used for headers; return false at EOF; NOT thread safe */
+    bool read(std::string &s, size_t n)
+    {
+        while (carry_.size() < n && !eof_) {
+            std::string compressed, inflated;
+            readBatch(compressed, 1);
+            inflateBatch(compressed, inflated);
+            splice(inflated, eof_);
+        }
+        if (carry_.size() < n) return false;
+        s.assign(carry_, 0, n);
+        carry_.erase(0, n);
+        return true;
+    }
+
+    /* fill block with complete records of type T; return false at EOF
+     * batches are sized by BGZF blocks instead of records, n is ignored; with max_bytes, a batch is as many
+     * blocks as inflate to about max_bytes, blocks_per_batch otherwise */
+    template<class T>
+    bool next(std::string &block, size_t n)
+    {
+        BlockPosition pos;
+        return next<T>(block, n, pos);
+    }
+
+    /* as above, pos is set to the position of block in the input */
+    template<class T>
+    bool next(std::string &block, size_t /* n */, BlockPosition &pos,
+              size_t max_bytes = std::numeric_limits<size_t>::max())
+    {
+        const size_t blocks = max_bytes == std::numeric_limits<size_t>::max() ? blocks_per_batch
+                                                                             : std::max<size_t>(1, max_bytes >> 16);
+        std::string compressed, inflated;
+        while (true) {
+            size_t ticket;
+            bool got, last;
+            {
+                std::lock_guard<std::mutex> lock(read_mx_);
+                got = readBatch(compressed, blocks);
+                last = eof_;
+                ticket = next_ticket_++;
+            }
+            inflated.clear();
+            inflateBatch(compressed, inflated);
+            {
+                std::unique_lock<std::mutex> lock(splice_mx_);
+                turn_cv_.wait(lock, [&] { return turn_ == ticket; });
+                splice(inflated, last);
+                size_t found = std::numeric_limits<size_t>::max();
+                bool eof = !got;
+                const char *stop = read_policy<T>::scan(carry_.data(), carry_.data() + carry_.size(), found, eof);
+                block.assign(static_cast<const char *>(carry_.data()), stop);
+                carry_.erase(0, block.size());
+                pos = handed_;
+                handed_.seq += !block.empty();
+                handed_.first += found;
+                if (eof && got) {
+                    ill_formatted_ = true;
+                }
+                if (ill_formatted_ || !got) {
+                    carry_.clear(); // nothing else will ever be handed out
+                }
+                ++turn_;
+            }
+            turn_cv_.notify_all();
+            if (!block.empty()) return true;
+            if (!got || ill_formatted_) return false;
+        }
+    }
+
+private:
+    /* read at most n compressed blocks into compressed; return false at EOF */
+    bool readBatch(std::string &compressed, size_t n)
+    {
+        compressed.clear();
+        char h[k_bgzf_header_size];
+        for (size_t i = 0; i < n && !eof_; ++i) {
+            if (!ins_.read(h, k_bgzf_header_size)) {
+                eof_ = true;
+                break;
+            }
+            if (!isBgzfHeader(h)) {
+                fprintf(stderr, "Error: invalid BGZF block header in the input\n");
+                exit(EXIT_FAILURE);
+            }
+            size_t size = bgzfBlockSize(h);
+            size_t off = compressed.size();
+            compressed.resize(off + size);
+            memcpy(&compressed[off], h, k_bgzf_header_size);
+            if (!ins_.read(&compressed[off + k_bgzf_header_size], size - k_bgzf_header_size)) {
+                fprintf(stderr, "Error: truncated BGZF block in the input\n");
+                exit(EXIT_FAILURE);
+            }
+            if (drop_ && ins_.peek() == EOF) {
+                eof_ = true; /* the last block of a shard, of which drop_ bytes are left out */
+            }
+        }
+        return !compressed.empty();
+    }
+
+    /* append the data inflated from a batch to carry_, but the bytes left out of the shard, if any; last is
+     * whether the batch ends the input */
+    void splice(const std::string &inflated, bool last)
+    {
+        size_t n = inflated.size() - (last ? std::min(drop_, inflated.size()) : 0);
+        size_t k = std::min(skip_, n);
+        skip_ -= k;
+        carry_.append(inflated, k, n - k);
+    }
+
+    /* inflate the blocks read by readBatch(), appending to out */
+    static void inflateBatch(const std::string &compressed, std::string &out)
+    {
+        for (size_t off = 0; off < compressed.size();) {
+            size_t size = bgzfBlockSize(compressed.data() + off);
+            if (!inflateBgzfBlock(compressed.data() + off, size, out)) {
+                fprintf(stderr, "Error: corrupted BGZF block in the input\n");
+                exit(EXIT_FAILURE);
+            }
+            off += size;
+        }
+    }
+
+    boost::iostreams::filtering_istream ins_;
+    bool eof_ = false;
+    std::mutex read_mx_;
+    size_t next_ticket_ = 0;
+    /* data below is guarded by splice_mx_ once next() is used */
+    std::mutex splice_mx_;
+    std::condition_variable turn_cv_;
+    size_t turn_ = 0;
+    std::string carry_;
+    size_t skip_ = 0; /* see ShardRange */
+    size_t drop_ = 0;
+    bool ill_formatted_ = false;
+    BlockPosition handed_;
+};
+
+#endif /* bgzf_hpp */
@@ -45,6 +45,7 @@
 #include "format.hpp"
 #include "sequence.hpp"
 #include "type_policy.h"
+#include "kernel_color.h"
 
 template<class T = caseInsensitiveString>
 struct Fasta: public Sequence<T>
@@ -53,6 +54,8 @@ struct Fasta: public Sequence<T>
     using iterator = FormatReaderIter<Fasta>;
     std::string
         name_; // sequence can take different representation such as char*, std::string or twoBits; name has to be string
+    const char *raw_ = nullptr; // the record as read from a memory block, valid while the block lives
+    size_t raw_size_ = 0;
 };
 
 /* reading policy */
@@ -82,6 +85,122 @@ struct read_policy<Fasta<T> >
         }
         return fa;
     }
+
+    // reading policy for fasta in a memory block; p is moved to the next record; fasta has no fields to skip
+    static fasta_type read(const char *&p, const char *e, unsigned fields = k_all_fields)
+    {
+        fasta_type fa{};
+        read(fa, p, e, fields);
+        return fa;
+    }
+
+    // as above, into fa, a record read before, reusing the capacity of its strings
+    static void read(fasta_type &fa, const char *&p, const char *e, unsigned /* fields */ = k_all_fields)
+    {
+        fa.seq_.clear();
+        if (p == e || *p != '>') {
+            p = e;
+            fa.name_.clear();
+            fa.raw_ = nullptr;
+            fa.raw_size_ = 0;
+            return; // an empty Fa meant end of block or ill-formated file
+        }
+        fa.raw_ = p;
+        const char *l = lineEnd(++p, e); // consume '>'
+        fa.name_.assign(p, l);
+        p = l + (l != e);
+        while (p != e && *p != '>') {
+            l = lineEnd(p, e);
+            fa.seq_.append(p, l);
+            p = l + (l != e);
+        }
+        fa.raw_size_ = p - fa.raw_;
+    }
+
+    // boundary scan: skip at most n records, each ends right before a line starting with '>'
+    static const char *scan(const char *b, const char *e, size_t &n, bool &eof)
+    {
+        size_t found = 0;
+        while (found < n && b != e) {
+            if (*b != '>') {
+                eof = true; // ill-formated file, stop here
+                break;
+            }
+            const char *l = b;
+            while (true) {
+                l = lineEnd(l, e);
+                if (l == e || ++l == e) {
+                    l = nullptr; // cannot tell whether the record ends here
+                    break;
+                }
+                if (*l == '>') break;
+            }
+            if (!l) {
+                if (!eof) break; // incomplete record
+                l = e;
+            }
+            b = l;
+            ++found;
+        }
+        n = found;
+        return b;
+    }
+
+    // resync at any byte of the input: the first record in [b, e) right after a line break; e if there is none,
+    // nullptr if more of the input is needed to tell unless eof
+    static const char *sync(const char *b, const char *e, bool eof)
+    {
+        for (const char *p = lineEnd(b, e); p != e; p = lineEnd(p, e)) {
+            if (++p == e) break;
+            if (*p == '>') return p;
+        }
+        return eof ? e : nullptr;
+    }
+};
+
+/* writing policy, sequence is always written in a single line */
+template<class T>
+struct write_policy<Fasta<T> >
+{
+    using fasta_type = Fasta<T>;
+
+    // append fa without its last trimmed nucleotides to out
+    static void write(OutputArena &out, const fasta_type &fa, size_t trimmed)
+    {
+        out.append('>');
+        out.append(fa.name_);
+        out.append('\n');
+        out.append(fa.seq_.data(), fa.seq_.size() - trimmed);
+        out.append('\n');
+    }
+
+    // append the slices of fa without its last trimmed nucleotides to iov, nothing is copied;
+    // an untrimmed record on a single line is sent as it was read
+    static void gather(std::vector<iovec> &iov, const fasta_type &fa, size_t trimmed)
+    {
+        if (!trimmed && fa.raw_ && fa.raw_size_ == fa.name_.size() + fa.seq_.size() + 3) {
+            addSlice(iov, fa.raw_, fa.raw_size_);
+            return;
+        }
+        addSlice(iov, ">", 1);
+        addSlice(iov, fa.name_.data(), fa.name_.size());
+        addSlice(iov, "\n", 1);
+        addSlice(iov, fa.seq_.data(), fa.seq_.size() - trimmed);
+        addSlice(iov, "\n", 1);
+    }
+
+    // append fa to out with its last trimmed nucleotides colored
+    static void writeColor(OutputArena &out, const fasta_type &fa, size_t trimmed)
+    {
+        const size_t kept = fa.seq_.size() - trimmed;
+        out.append('>');
+        out.append(fa.name_);
+        out.append('\n');
+        out.append(fa.seq_.data(), kept);
+        out.append(KERNAL_RED);
+        out.append(fa.seq_.data() + kept, trimmed);
+        out.append("\n" KERNAL_RESET);
+    }
 };
 
 template<class T>
@@ -45,6 +45,7 @@
 #include "format.hpp"
 #include "sequence.hpp"
 #include "type_policy.h"
+#include "kernel_color.h"
 
 template<class T = caseInsensitiveString>
 struct Fastq: public Sequence<T>
@@ -52,7 +53,32 @@ struct Fastq: public Sequence<T>
     using seq_type = Sequence<T>;
     using iterator = FormatReaderIter<Fastq>;
     std::string name_;
-    std::string quality_;
+    std::string quality_; // empty while the quality is left in the block, see quality()
+    const char *raw_ = nullptr; // the record as read from a memory block, valid while the block lives
+    size_t raw_size_ = 0;
+    const char *quality_raw_ = nullptr; // the quality line in that block, until it is copied into quality_
+    size_t quality_raw_size_ = 0;
+
+    /* the quality, copied out of the block on first use */
+    const std::string &quality()
+    {
+        if (quality_raw_) {
+            quality_.assign(quality_raw_, quality_raw_size_);
+            quality_raw_ = nullptr;
+        }
+        return quality_;
+    }
+
+    /* the quality wherever it is, without copying it */
+    const char *qualityData() const
+    {
+        return quality_raw_ ? quality_raw_ : quality_.data();
+    }
+
+    size_t qualitySize() const
+    {
+        return quality_raw_ ? quality_raw_size_ : quality_.size();
+    }
 };
 
 /* reading policy */
@@ -85,6 +111,159 @@ struct read_policy<Fastq<T> >
         }
         return fq;
     }
+
+    // reading policy for fastq in a memory block; p is moved to the next record
+    // the quality is only read if fields has k_field_quality, and only located unless it has k_field_owned
+    static fastq_type read(const char *&p, const char *e, unsigned fields = k_all_fields)
+    {
+        fastq_type fq{};
+        read(fq, p, e, fields);
+        return fq;
+    }
+
+    // as above, into fq, a record read before, reusing the capacity of its strings
+    static void read(fastq_type &fq, const char *&p, const char *e, unsigned fields = k_all_fields)
+    {
+        fq.quality_.clear();
+        fq.quality_raw_ = nullptr;
+        fq.quality_raw_size_ = 0;
+        if (p == e || *p != '@') {
+            p = e;
+            fq.name_.clear();
+            fq.seq_.clear();
+            fq.raw_ = nullptr;
+            fq.raw_size_ = 0;
+            return; // an empty Fq meant end of block or ill-formated file
+        }
+        fq.raw_ = p;
+        const char *l = lineEnd(++p, e); // consume '@'
+        fq.name_.assign(p, l);
+        p = l + (l != e);
+        l = lineEnd(p, e);
+        fq.seq_.assign(p, l);
+        p = l + (l != e);
+        l = lineEnd(p, e); // '+' line
+        p = l + (l != e);
+        l = lineEnd(p, e);
+        if ((fields & k_field_quality) && (fields & k_field_owned)) {
+            fq.quality_.assign(p, l);
+        } else if (fields & k_field_quality) {
+            fq.quality_raw_ = p;
+            fq.quality_raw_size_ = l - p;
+        }
+        const size_t quality_size = l - p;
+        p = l + (l != e);
+        fq.raw_size_ = p - fq.raw_;
+        if (fq.seq_.size() != quality_size) {
+            fprintf(stderr, "[warning] the length of sequence and quality does not match for %s\n",
+                    fq.name_.c_str());
+        }
+    }
+
+    // boundary scan: skip at most n records of four lines each, see FormatBlockReader
+    static const char *scan(const char *b, const char *e, size_t &n, bool &eof)
+    {
+        size_t found = 0;
+        while (found < n && b != e) {
+            if (*b != '@') {
+                eof = true; // ill-formated file, stop here
+                break;
+            }
+            const char *l = b;
+            int lines = 0;
+            for (; lines < 4 && l != e; ++lines) {
+                l = lineEnd(l, e);
+                l += (l != e);
+            }
+            if (lines < 4 || (l == e && *(l - 1) != '\n')) {
+                if (!eof) break; // incomplete record
+                l = e;
+            }
+            b = l;
+            ++found;
+        }
+        n = found;
+        return b;
+    }
+
+    // resync at any byte of the input: the first record in [b, e) right after a line break, told from a quality
+    // line starting with '@' by the '+' line and the quality as long as the sequence that follow it; e if there is
+    // none, nullptr if more of the input is needed to tell unless eof
+    static const char *sync(const char *b, const char *e, bool eof)
+    {
+        for (const char *p = lineEnd(b, e); p != e; p = lineEnd(p, e)) {
+            if (++p == e) break;
+            if (*p != '@') continue;
+            const char *seq = nextLine(p, e);
+            const char *plus = nextLine(seq, e);
+            const char *qual = nextLine(plus, e);
+            const char *qual_end = lineEnd(qual, e);
+            if (qual_end == e && !eof) return nullptr;
+            if (plus != e && *plus == '+' && qual_end - qual == lineEnd(seq, e) - seq) return p;
+        }
+        return eof ? e : nullptr;
+    }
+};
+
+/* writing policy */
+template<class T>
+struct write_policy<Fastq<T> >
+{
+    using fastq_type = Fastq<T>;
+
+    // # of quality values written with the first kept nucleotides, fewer if the quality is shorter than the
+    // sequence, see read_policy::read
+    static size_t qualityKept(const fastq_type &fq, size_t kept)
+    {
+        return std::min(fq.qualitySize(), kept);
+    }
+
+    // append fq without its last trimmed nucleotides to out
+    static void write(OutputArena &out, const fastq_type &fq, size_t trimmed)
+    {
+        out.append('@');
+        out.append(fq.name_);
+        out.append('\n');
+        out.append(fq.seq_.data(), fq.seq_.size() - trimmed);
+        out.append("\n+\n");
+        out.append(fq.qualityData(), qualityKept(fq, fq.seq_.size() - trimmed));
+        out.append('\n');
+    }
+
+    // append the slices of fq without its last trimmed nucleotides to iov, nothing is copied;
+    // an untrimmed record laid out as written is sent as it was read
+    static void gather(std::vector<iovec> &iov, const fastq_type &fq, size_t trimmed)
+    {
+        if (!trimmed && fq.raw_ && fq.raw_size_ == fq.name_.size() + fq.seq_.size() + fq.qualitySize() + 6) {
+            addSlice(iov, fq.raw_, fq.raw_size_);
+            return;
+        }
+        addSlice(iov, "@", 1);
+        addSlice(iov, fq.name_.data(), fq.name_.size());
+        addSlice(iov, "\n", 1);
+        addSlice(iov, fq.seq_.data(), fq.seq_.size() - trimmed);
+        addSlice(iov, "\n+\n", 3);
+        addSlice(iov, fq.qualityData(), qualityKept(fq, fq.seq_.size() - trimmed));
+        addSlice(iov, "\n", 1);
+    }
+
+    // append fq to out with its last trimmed nucleotides colored
+    static void writeColor(OutputArena &out, const fastq_type &fq, size_t trimmed)
+    {
+        const size_t kept = fq.seq_.size() - trimmed;
+        const size_t qual_kept = qualityKept(fq, kept);
+        out.append('@');
+        out.append(fq.name_);
+        out.append('\n');
+        out.append(fq.seq_.data(), kept);
+        out.append(KERNAL_RED);
+        out.append(fq.seq_.data() + kept, trimmed);
+        out.append(KERNAL_RESET "\n+\n");
+        out.append(fq.qualityData(), qual_kept);
+        out.append(KERNAL_RED);
+        out.append(fq.qualityData() + qual_kept, fq.qualitySize() - qual_kept);
+        out.append("\n" KERNAL_RESET);
+    }
 };
 
 template<class T>
@@ -42,11 +42,19 @@
 
 #include <unistd.h>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <mutex>
+#include <chrono>
 #include <iostream>
+#include <poll.h>
 #include <fstream>
 #include <boost/iterator/iterator_facade.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include "type_policy.h"
+#include "arena.hpp"
+#include "io_backend.hpp"
 
 #ifdef TO_SUPPORT_COMPRESSED_INPUT
 #include <boost/iostreams/filter/gzip.hpp>
@@ -99,6 +107,119 @@ private:
 };
 /* end of iterator definition */
 
+/* end of the line starting at p, i.e. the position of '\n' or e */
+inline const char *lineEnd(const char *p, const char *e)
+{
+    const char *l = static_cast<const char *>(memchr(p, '\n', e - p));
+    return l ? l : e;
+}
+
+/* start of the line after the one p is in, e if there is none */
+inline const char *nextLine(const char *p, const char *e)
+{
+    p = lineEnd(p, e);
+    return p == e ? e : p + 1;
+}
+
+/* where a block handed out by a block reader sits in the input */
+struct BlockPosition
+{
+    uint64_t seq = 0; // # of blocks handed out before it
+    uint64_t first = 0; // # of records before it, i.e. the ordinal of its first record
+    std::chrono::steady_clock::time_point ready{}; // when its first record was complete, in streaming mode only
+};
+
+/* the part of the input a shard reads, see --shard: the bytes [begin, end) of the file; for BGZF input, begin and
+ * end are offsets of blocks, and skip and drop the bytes inflated from the first and the last block that are left out */
+struct ShardRange
+{
+    off_t begin = 0;
+    off_t end = 0;
+    size_t skip = 0;
+    size_t drop = 0;
+};
+
+/* fields of a record read_policy::read fills in besides its name and sequence; without k_field_owned,
+ * fields that can be are left in the block, located but not copied until asked for, and the block
+ * has to outlive the record */
+enum RecordFields: unsigned
+{
+    k_field_quality = 1u,
+    k_field_owned = 2u,
+    k_all_fields = ~0u
+};
+
+/* append the n bytes at p to iov for a scatter-gather write; they must outlive the write */
+inline void addSlice(std::vector<iovec> &iov, const char *p, size_t n)
+{
+    if (n) {
+        iov.push_back(iovec{const_cast<char *>(p), n});
+    }
+}
+
+/* push file_name (or stdin for "stdin" and "-") to ins as it is; regular files are read through
+ * the backend of kind io ahead of time, unless it is STREAM */
+inline void openRawStream(const std::string &file_name, boost::iostreams::filtering_istream &ins,
+                          IoBackendKind io = IoBackendKind::STREAM)
+{
+    if (file_name == "stdin" || file_name == "-") {
+        std::ios::sync_with_stdio(false);
+        std::cin.tie(nullptr);
+        std::cerr.tie(nullptr);
+        ins.push(std::cin);
+        return;
+    }
+    if (access(file_name.c_str(), R_OK) != 0) {
+        fprintf(stderr, "error, cannot read file %s. Please double check.\n", file_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (io != IoBackendKind::STREAM) {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            ins.push(AsyncFileSource{fd, io}, AsyncFileSource::buffer_size);
+            return;
+        }
+        if (fd >= 0) close(fd);
+    }
+    ins.push(*new std::ifstream{file_name, std::ios::binary});
+}
+
+/* push the bytes [begin, end) of the regular file file_name to ins, read through the backend of kind io, pread
+ * for STREAM */
+inline void openRawRange(const std::string &file_name, boost::iostreams::filtering_istream &ins, IoBackendKind io,
+                         off_t begin, off_t end)
+{
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "error, cannot read file %s. Please double check.\n", file_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    ins.push(AsyncFileSource{fd, io == IoBackendKind::STREAM ? IoBackendKind::SYNC : io, begin, end},
+             AsyncFileSource::buffer_size);
+}
+
+/* open file_name (or stdin for "stdin" and "-") and push it, along with a decompressor if needed, to ins */
+inline void openFormatStream(const std::string &file_name, boost::iostreams::filtering_istream &ins,
+                             IoBackendKind io = IoBackendKind::STREAM)
+{
+#ifdef TO_SUPPORT_COMPRESSED_INPUT
+#define GZIP_MAGIC "\037\213"
+#define BZIP2_MAGIC "BZ"
+    if (file_name != "stdin" && file_name != "-") {
+        char magic_number[3] = {0, 0, 0};
+        std::ifstream{file_name}.get(magic_number, 3);
+        if (memcmp(magic_number, GZIP_MAGIC, 2) == 0) {
+            ins.push(boost::iostreams::gzip_decompressor());
+        }
+        else if (memcmp(magic_number, BZIP2_MAGIC, 2) == 0) {
+            ins.push(boost::iostreams::bzip2_decompressor());
+        }
+    }
+#endif
+    openRawStream(file_name, ins, io);
+}
+
 template<class T>
 class FormatReader
 {
@@ -108,33 +229,7 @@ public:
 
     explicit FormatReader(const std::string &file_name)
     {
-        std::istream *p_ist_in{&std::cin};
-        if (file_name != "stdin" && file_name != "-") {
-            if (access(file_name.c_str(), R_OK) != 0) {
-                fprintf(stderr, "error, cannot read file %s. Please double check.\n", file_name.c_str());
-                exit(EXIT_FAILURE);
-            }
-            p_ist_in = new std::ifstream{file_name};
-#ifdef TO_SUPPORT_COMPRESSED_INPUT
-#define GZIP_MAGIC "\037\213"
-#define BZIP2_MAGIC "BZ"
-            char magic_number[3];
-            p_ist_in->get(magic_number, 3);
-            if (memcmp(magic_number, GZIP_MAGIC, 2) == 0) {
-                ins_.push(boost::iostreams::gzip_decompressor());
-            }
-            else if (memcmp(magic_number, BZIP2_MAGIC, 2) == 0) {
-                ins_.push(boost::iostreams::bzip2_decompressor());
-            }
-            p_ist_in->seekg(0, p_ist_in->beg);
-#endif
-        }
-        else {
-            std::ios::sync_with_stdio(false);
-            std::cin.tie(nullptr);
-            std::cerr.tie(nullptr);
-        }
-        ins_.push(*p_ist_in);
+        openFormatStream(file_name, ins_);
     }
 
     ~FormatReader()
@@ -154,6 +249,188 @@ protected:
     boost::iostreams::filtering_istream ins_;
 };
 
+/* reader handing out raw, record-aligned blocks of bytes instead of parsed records
+ * only a cheap boundary scan (read_policy<T>::scan) is done here; the records in a block are
+ * parsed later by read_policy<T>::read(const char *&, const char *), which can happen without any lock held
+ * scan(b, e, n, eof) returns the end of the last complete record in [b, e) and sets n to the # of records found;
+ * with eof set, an unterminated last record counts as complete; ill-formatted data sets eof to stop reading
+ * the reader itself does not depend on the format, so peek() can be used to detect it before reading any block
+ * next() is thread safe, the lock is held for reading and scanning only
+ * */
+class FormatBlockReader
+{
+public:
+    /* size of each read from the underlying stream */
+    constexpr static size_t chunk_size = 1 << 22;
+
+    explicit FormatBlockReader(const std::string &file_name, IoBackendKind io = IoBackendKind::STREAM)
+    {
+        openFormatStream(file_name, ins_, io);
+    }
+
+    /* only the records of a shard of the plain file file_name, see shard.hpp */
+    FormatBlockReader(const std::string &file_name, IoBackendKind io, const ShardRange &range)
+    {
+        openRawRange(file_name, ins_, io, range.begin, range.end);
+    }
+
+    /* streaming mode, e.g. reads piped from a sequencer as they come: the input is read straight from its file
+     * descriptor, as much as is there at a time, and next() hands out the records it has once the first of them
+     * has waited max_wait for the rest of the block; compressed input is not supported */
+    FormatBlockReader(const std::string &file_name, std::chrono::milliseconds max_wait)
+        : max_wait_(max_wait)
+    {
+        fd_ = file_name == "stdin" || file_name == "-" ? STDIN_FILENO : open(file_name.c_str(), O_RDONLY);
+        if (fd_ < 0) {
+            fprintf(stderr, "error, cannot read file %s. Please double check.\n", file_name.c_str());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ~FormatBlockReader()
+    {
+        if (fd_ > STDIN_FILENO) {
+            close(fd_);
+        }
+    }
+
+    /* first byte of the remaining input, EOF if there is none; NOT thread safe */
+    int peek()
+    {
+        if (beg_ == end_ && !eof_) {
+            fill();
+        }
+        return beg_ == end_ ? EOF : static_cast<unsigned char>(buf_[beg_]);
+    }
+
+    /* fill block with at most n complete records of type T; return false at EOF */
+    template<class T>
+    bool next(std::string &block, size_t n)
+    {
+        BlockPosition pos;
+        return next<T>(block, n, pos);
+    }
+
+    /* as above, pos is set to the position of block in the input; block also stops short of max_bytes
+     * unless its first record alone is longer */
+    template<class T>
+    bool next(std::string &block, size_t n, BlockPosition &pos,
+              size_t max_bytes = std::numeric_limits<size_t>::max())
+    {
+        std::lock_guard<std::mutex> lock(mx_);
+        const char *stop;
+        size_t found;
+        std::chrono::steady_clock::time_point ready{}; /* streaming: when a record first was complete */
+        while (true) {
+            found = n;
+            const bool cut = end_ - beg_ > max_bytes;
+            bool eof = eof_ && !cut;
+            stop = read_policy<T>::scan(buf_.data() + beg_, buf_.data() + (cut ? beg_ + max_bytes : end_), found, eof);
+            eof_ = eof_ || eof; /* or ill-formatted */
+            if (found == n || (cut ? found || eof : eof_)) break;
+            if (cut) {
+                max_bytes = std::numeric_limits<size_t>::max(); /* the first record is longer, hand it out alone */
+                n = 1;
+            } else if (fd_ < 0) {
+                fill(); /* not enough complete records in the buffer */
+            } else {
+                if (found && ready == std::chrono::steady_clock::time_point{}) {
+                    ready = std::chrono::steady_clock::now();
+                }
+                const size_t scanned = stop - (buf_.data() + beg_);
+                if (!fillSome(found ? ready + max_wait_ : std::chrono::steady_clock::time_point::max())) {
+                    stop = buf_.data() + beg_ + scanned; /* the buffer may have moved */
+                    break; /* the first record waited long enough, hand out those there are */
+                }
+            }
+        }
+        block.assign(static_cast<const char *>(buf_.data() + beg_), stop);
+        beg_ = stop - buf_.data();
+        pos = handed_;
+        if (fd_ >= 0) {
+            pos.ready = ready == std::chrono::steady_clock::time_point{} ? std::chrono::steady_clock::now() : ready;
+        }
+        handed_.seq += !block.empty();
+        handed_.first += found;
+        return !block.empty();
+    }
+
+private:
+    void fill()
+    {
+        /* move the incomplete record to the front and make room for at least another chunk */
+        size_t left = end_ - beg_;
+        if (beg_) {
+            memmove(&buf_[0], buf_.data() + beg_, left);
+            beg_ = 0;
+            end_ = left;
+        }
+        if (buf_.size() < left + chunk_size) {
+            buf_.resize(std::max(left + chunk_size, buf_.size() * 2));
+        }
+        if (fd_ >= 0) {
+            fillSome(std::chrono::steady_clock::time_point::max());
+            return;
+        }
+        ins_.read(&buf_[end_], buf_.size() - end_);
+        end_ += ins_.gcount();
+        if (!ins_) {
+            eof_ = true;
+        }
+    }
+
+    /* streaming mode: append whatever there is to read, waiting for it until deadline; false if none came */
+    bool fillSome(std::chrono::steady_clock::time_point deadline)
+    {
+        size_t left = end_ - beg_;
+        if (beg_) {
+            memmove(&buf_[0], buf_.data() + beg_, left);
+            beg_ = 0;
+            end_ = left;
+        }
+        if (buf_.size() < left + chunk_size) {
+            buf_.resize(std::max(left + chunk_size, buf_.size() * 2));
+        }
+        while (true) {
+            int timeout = -1;
+            if (deadline != std::chrono::steady_clock::time_point::max()) {
+                auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count() + 1;
+                timeout = static_cast<int>(std::max<long long>(0, std::min<long long>(wait, INT32_MAX)));
+            }
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            int ready = poll(&pfd, 1, timeout);
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready == 0) {
+                return false;
+            }
+            ssize_t got = read(fd_, &buf_[end_], buf_.size() - end_);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                fprintf(stderr, "Error: failed to read input: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+            end_ += got;
+            eof_ = got == 0;
+            return true;
+        }
+    }
+
+    boost::iostreams::filtering_istream ins_;
+    std::vector<char> buf_;
+    size_t beg_ = 0;
+    size_t end_ = 0;
+    bool eof_ = false;
+    int fd_ = -1; /* streaming mode only, see max_wait_ */
+    std::chrono::milliseconds max_wait_{0};
+    BlockPosition handed_;
+    std::mutex mx_;
+};
+
 #endif /* format_h */
 
 #pragma GCC diagnostic pop
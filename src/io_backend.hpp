@@ -0,0 +1,625 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#ifndef io_backend_hpp
+#define io_backend_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <boost/iostreams/categories.hpp>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define TO_SUPPORT_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+/* how files are read and written */
+enum class IoBackendKind {
+    STREAM, /* iostreams and stdio, as it always was */
+    SYNC, /* pread/pwrite */
+    URING /* io_uring, several requests in flight; falls back to SYNC if unavailable */
+};
+
+/* backend doing reads and writes of a file descriptor, possibly asynchronously
+ * requests are submitted with a tag, which comes back with the # of bytes (or -errno) once the request completes
+ * buffers can be registered up front and then referred to by index, saving the kernel mapping them each time
+ * an instance is used by one thread at a time
+ * */
+class IoBackend
+{
+public:
+    virtual ~IoBackend()
+    { }
+
+    /* max # of requests in flight */
+    virtual size_t depth() const = 0;
+
+    /* register buffers for the requests to refer to by buf_index; return false if not supported */
+    virtual bool registerBuffers(const std::vector<iovec> &)
+    {
+        return false;
+    }
+
+    /* offset -1 stands for the current file position, as for pipes; buf_index -1 for an unregistered buffer */
+    virtual void submitRead(int fd, char *buf, size_t n, off_t offset, uint64_t tag, int buf_index) = 0;
+
+    virtual void submitWrite(int fd, const char *buf, size_t n, off_t offset, uint64_t tag, int buf_index) = 0;
+
+    /* wait for any request to complete */
+    virtual void wait(uint64_t &tag, ssize_t &res) = 0;
+};
+
+/* pread/pwrite, each request completes right away */
+class SyncIoBackend: public IoBackend
+{
+public:
+    explicit SyncIoBackend(size_t depth)
+        : depth_(depth)
+    { }
+
+    size_t depth() const override
+    {
+        return depth_;
+    }
+
+    void submitRead(int fd, char *buf, size_t n, off_t offset, uint64_t tag, int) override
+    {
+        ssize_t res;
+        do {
+            res = offset < 0 ? ::read(fd, buf, n) : pread(fd, buf, n, offset);
+        } while (res < 0 && errno == EINTR);
+        done_.emplace_back(tag, res < 0 ? -errno : res);
+    }
+
+    void submitWrite(int fd, const char *buf, size_t n, off_t offset, uint64_t tag, int) override
+    {
+        ssize_t res;
+        do {
+            res = offset < 0 ? ::write(fd, buf, n) : pwrite(fd, buf, n, offset);
+        } while (res < 0 && errno == EINTR);
+        done_.emplace_back(tag, res < 0 ? -errno : res);
+    }
+
+    void wait(uint64_t &tag, ssize_t &res) override
+    {
+        tag = done_.front().first;
+        res = done_.front().second;
+        done_.pop_front();
+    }
+
+private:
+    size_t depth_;
+    std::deque<std::pair<uint64_t, ssize_t> > done_;
+};
+
+#ifdef TO_SUPPORT_IO_URING
+/* io_uring through raw system calls, no liburing needed */
+class IoUringBackend: public IoBackend
+{
+public:
+    /* throw nothing; check ok() as io_uring may be missing or forbidden, e.g. in containers */
+    explicit IoUringBackend(size_t depth)
+        : depth_(depth)
+    {
+        io_uring_params p;
+        memset(&p, 0, sizeof(p));
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(depth), &p));
+        if (fd_ < 0) return;
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        cq_ptr_ = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr_
+            : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes == MAP_FAILED || !supported()) {
+            if (sqes != MAP_FAILED) munmap(sqes, sqes_size_);
+            if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+            if (sq_ptr_ != MAP_FAILED) munmap(sq_ptr_, sq_size_);
+            close(fd_);
+            fd_ = -1;
+            return;
+        }
+        char *sq = static_cast<char *>(sq_ptr_);
+        char *cq = static_cast<char *>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+    }
+
+    ~IoUringBackend() override
+    {
+        if (fd_ < 0) return;
+        munmap(sqes_, sqes_size_);
+        if (cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_size_);
+        munmap(sq_ptr_, sq_size_);
+        close(fd_);
+    }
+
+    bool ok() const
+    {
+        return fd_ >= 0;
+    }
+
+    size_t depth() const override
+    {
+        return depth_;
+    }
+
+    bool registerBuffers(const std::vector<iovec> &iovs) override
+    {
+        /* fails when the buffers exceed RLIMIT_MEMLOCK, unregistered buffers are used then */
+        return syscall(__NR_io_uring_register, fd_, IORING_REGISTER_BUFFERS, iovs.data(),
+                       static_cast<unsigned>(iovs.size())) == 0;
+    }
+
+    void submitRead(int fd, char *buf, size_t n, off_t offset, uint64_t tag, int buf_index) override
+    {
+        submit(buf_index < 0 ? IORING_OP_READ : IORING_OP_READ_FIXED, fd, buf, n, offset, tag, buf_index);
+    }
+
+    void submitWrite(int fd, const char *buf, size_t n, off_t offset, uint64_t tag, int buf_index) override
+    {
+        submit(buf_index < 0 ? IORING_OP_WRITE : IORING_OP_WRITE_FIXED, fd, buf, n, offset, tag, buf_index);
+    }
+
+    void wait(uint64_t &tag, ssize_t &res) override
+    {
+        unsigned head = *cq_head_; // only we move the head
+        while (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR) {
+                fprintf(stderr, "Error: io_uring_enter failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+        const io_uring_cqe &cqe = cqes_[head & cq_mask_];
+        tag = cqe.user_data;
+        res = cqe.res;
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    }
+
+private:
+    /* whether the kernel has all the operations we submit; IORING_OP_READ and IORING_OP_WRITE, which unregistered
+     * buffers take, came in Linux 5.6, along with the probe itself, so older kernels are left to SyncIoBackend */
+    bool supported() const
+    {
+        const uint8_t ops[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED};
+        const unsigned n = 256;
+        std::vector<char> buf(sizeof(io_uring_probe) + n * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, n) < 0) return false;
+        for (uint8_t op : ops) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    void submit(uint8_t opcode, int fd, const char *buf, size_t n, off_t offset, uint64_t tag, int buf_index)
+    {
+        unsigned tail = *sq_tail_; // only we move the tail
+        unsigned idx = tail & sq_mask_;
+        io_uring_sqe &sqe = sqes_[idx];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = fd;
+        sqe.off = static_cast<uint64_t>(offset);
+        sqe.addr = reinterpret_cast<uint64_t>(buf);
+        sqe.len = static_cast<uint32_t>(n);
+        sqe.user_data = tag;
+        sqe.buf_index = buf_index < 0 ? 0 : static_cast<uint16_t>(buf_index);
+        sq_array_[idx] = idx;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        while (syscall(__NR_io_uring_enter, fd_, 1, 0, 0, nullptr, 0) < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                fprintf(stderr, "Error: io_uring_enter failed: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    size_t depth_;
+    int fd_ = -1;
+    size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+    void *sq_ptr_ = nullptr;
+    void *cq_ptr_ = nullptr;
+    unsigned *sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned *sq_array_ = nullptr;
+    io_uring_sqe *sqes_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+};
+#endif
+
+/* whether a request completed with res should be redone synchronously; io_uring cancels requests handed
+ * to its workers once the submitting thread exits, which our worker threads do at the end of input, and a kernel
+ * may reject an operation on a file that pread/pwrite take (-EINVAL), which then report the error if it is one */
+inline bool isRetriable(ssize_t res)
+{
+    return res == -ECANCELED || res == -EINTR || res == -EAGAIN || res == -EINVAL;
+}
+
+/* backend of kind, or nullptr for STREAM, which AsyncFileSource and AsyncFileSink do not take; URING falls back
+ * to SYNC where io_uring is missing, forbidden or lacks operations we need */
+inline std::unique_ptr<IoBackend> makeIoBackend(IoBackendKind kind, size_t depth)
+{
+    if (kind == IoBackendKind::STREAM) return nullptr;
+#ifdef TO_SUPPORT_IO_URING
+    if (kind == IoBackendKind::URING) {
+        std::unique_ptr<IoUringBackend> uring{new IoUringBackend{depth}};
+        if (uring->ok()) return std::move(uring);
+    }
+#endif
+    return std::unique_ptr<IoBackend>{new SyncIoBackend{depth}};
+}
+
+/* a fixed set of buffers, registered with the backend if it can */
+class IoBuffers
+{
+public:
+    IoBuffers(IoBackend &io, size_t size)
+        : data_(io.depth() * size), size_(size)
+    {
+        std::vector<iovec> iovs(io.depth());
+        for (size_t i = 0; i < iovs.size(); ++i) {
+            iovs[i].iov_base = &data_[i * size];
+            iovs[i].iov_len = size;
+        }
+        registered_ = io.registerBuffers(iovs);
+    }
+
+    char *operator[](size_t i)
+    {
+        return &data_[i * size_];
+    }
+
+    int index(size_t i) const
+    {
+        return registered_ ? static_cast<int>(i) : -1;
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+private:
+    std::vector<char> data_;
+    size_t size_;
+    bool registered_;
+};
+
+/* boost::iostreams source reading a regular file ahead, keeping all buffers of the backend in flight;
+ * only the bytes [begin, end) of it with a range */
+class AsyncFileSource
+{
+public:
+    typedef char char_type;
+    typedef boost::iostreams::source_tag category;
+
+    constexpr static size_t buffer_size = 1 << 20;
+    constexpr static size_t depth = 4;
+
+    AsyncFileSource(int fd, IoBackendKind kind, off_t begin = 0, off_t end = std::numeric_limits<off_t>::max())
+        : impl_(std::make_shared<Impl>(fd, kind, begin, end))
+    { }
+
+    std::streamsize read(char *s, std::streamsize n)
+    {
+        return impl_->read(s, n);
+    }
+
+private:
+    struct Impl
+    {
+        Impl(int fd, IoBackendKind kind, off_t begin, off_t end)
+            : fd_(fd), io_(makeIoBackend(kind, depth)), bufs_(*io_, buffer_size), len_(depth, -1),
+              offset_(begin), end_(end)
+        {
+            for (size_t i = 0; i < depth; ++i) {
+                submit(i);
+            }
+        }
+
+        ~Impl()
+        {
+            while (in_flight_) { // the kernel may still be writing to the buffers
+                complete();
+            }
+            close(fd_);
+        }
+
+        std::streamsize read(char *s, std::streamsize n)
+        {
+            std::streamsize copied = 0;
+            while (copied < n && !eof_) {
+                while (len_[cur_] < 0) {
+                    complete();
+                }
+                size_t k = std::min(static_cast<size_t>(n - copied), static_cast<size_t>(len_[cur_]) - pos_);
+                memcpy(s + copied, bufs_[cur_] + pos_, k);
+                copied += k;
+                pos_ += k;
+                if (pos_ == static_cast<size_t>(len_[cur_])) {
+                    eof_ = len_[cur_] < static_cast<ssize_t>(buffer_size);
+                    submit(cur_); // reuse the buffer for data further ahead
+                    cur_ = (cur_ + 1) % depth;
+                    pos_ = 0;
+                }
+            }
+            return copied ? copied : -1;
+        }
+
+        void submit(size_t i)
+        {
+            len_[i] = -1;
+            offsets_[i] = offset_;
+            want_[i] = offset_ < end_ ? static_cast<size_t>(std::min<off_t>(buffer_size, end_ - offset_)) : 0;
+            io_->submitRead(fd_, bufs_[i], want_[i], offset_, i, bufs_.index(i));
+            offset_ += want_[i];
+            ++in_flight_;
+        }
+
+        void complete()
+        {
+            uint64_t i;
+            ssize_t res;
+            io_->wait(i, res);
+            --in_flight_;
+            bool retry = isRetriable(res);
+            if (retry) {
+                res = 0;
+            }
+            if (res < 0) {
+                fprintf(stderr, "Error: failed to read input: %s\n", strerror(-res));
+                exit(EXIT_FAILURE);
+            }
+            /* a short read only happens at the end of the file, unless interrupted; finish it if so */
+            while ((retry || res > 0) && static_cast<size_t>(res) < want_[i]) {
+                ssize_t more = pread(fd_, bufs_[i] + res, want_[i] - res, offsets_[i] + res);
+                if (more < 0 && errno == EINTR) continue;
+                if (more < 0) {
+                    fprintf(stderr, "Error: failed to read input: %s\n", strerror(errno));
+                    exit(EXIT_FAILURE);
+                }
+                if (more == 0) break;
+                res += more;
+            }
+            len_[i] = res;
+        }
+
+        int fd_;
+        std::unique_ptr<IoBackend> io_;
+        IoBuffers bufs_;
+        std::vector<ssize_t> len_; /* # of bytes in each buffer, -1 while the read is in flight */
+        std::vector<off_t> offsets_ = std::vector<off_t>(depth, 0);
+        std::vector<size_t> want_ = std::vector<size_t>(depth, 0); /* # of bytes asked for, short of the end */
+        off_t offset_;
+        off_t end_;
+        size_t in_flight_ = 0;
+        size_t cur_ = 0;
+        size_t pos_ = 0;
+        bool eof_ = false;
+    };
+
+    std::shared_ptr<Impl> impl_;
+};
+
+/* write all n iov to fd, at offset unless it is negative; iov is consumed. Returns the # of bytes written */
+inline size_t writevFully(int fd, struct iovec *iov, int n, off_t offset)
+{
+    size_t total = 0;
+    while (n) {
+        int k = std::min(n, IOV_MAX);
+        ssize_t res = offset < 0 ? ::writev(fd, iov, k) : pwritev(fd, iov, k, offset + total);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res < 0) {
+            fprintf(stderr, "Error: failed to write output: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        total += res;
+        size_t done = res;
+        for (; n && done >= iov->iov_len; --n, ++iov) { // skip what is written
+            done -= iov->iov_len;
+        }
+        if (n) { // partially written
+            iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+    return total;
+}
+
+/* output to a file descriptor through the backend; data is copied into one of its buffers, which is written
+ * once full while the next one is filled. Regular files keep all buffers in flight at their own offsets,
+ * pipes one at a time to keep the order. NOT thread safe
+ * */
+class AsyncFileSink
+{
+public:
+    constexpr static size_t buffer_size = 1 << 22;
+    constexpr static size_t depth = 4;
+
+    /* owned: fd was opened for the sink alone, so that a regular file is written at offsets of its own with
+     * several writes in flight; otherwise, e.g. stdout inherited from the shell, which may share its file position
+     * with stderr as in "> log 2>&1", it is written in order at that position, one write in flight */
+    AsyncFileSink(int fd, IoBackendKind kind, bool owned = false)
+        : fd_(fd), io_(makeIoBackend(kind, depth)), bufs_(*io_, buffer_size), used_(depth, 0), busy_(depth, false)
+    {
+        struct stat st;
+        seekable_ = owned && fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+        offset_ = seekable_ ? lseek(fd, 0, SEEK_CUR) : -1;
+        if (offset_ < 0) {
+            seekable_ = false;
+        }
+    }
+
+    ~AsyncFileSink()
+    {
+        flush();
+    }
+
+    AsyncFileSink(const AsyncFileSink &) = delete;
+
+    AsyncFileSink &operator=(const AsyncFileSink &) = delete;
+
+    void write(const char *p, size_t n)
+    {
+        while (n) {
+            size_t k = std::min(n, buffer_size - used_[cur_]);
+            memcpy(bufs_[cur_] + used_[cur_], p, k);
+            used_[cur_] += k;
+            p += k;
+            n -= k;
+            if (used_[cur_] == buffer_size) {
+                submit();
+            }
+        }
+    }
+
+    /* write n iov straight from where they are, after all buffered data; iov is consumed */
+    void writev(struct iovec *iov, int n)
+    {
+        flush();
+        size_t written = writevFully(fd_, iov, n, seekable_ ? offset_ : -1);
+        if (seekable_) {
+            offset_ += written;
+            lseek(fd_, offset_, SEEK_SET);
+        }
+    }
+
+    /* write all buffered data and wait for it */
+    void flush()
+    {
+        if (used_[cur_]) {
+            submit();
+        }
+        while (in_flight_) {
+            complete();
+        }
+        if (seekable_) {
+            lseek(fd_, offset_, SEEK_SET); // for anyone writing after us
+        }
+    }
+
+private:
+    void submit()
+    {
+        if (!seekable_) {
+            while (in_flight_) complete();
+        }
+        busy_[cur_] = true;
+        ++in_flight_;
+        io_->submitWrite(fd_, bufs_[cur_], used_[cur_], seekable_ ? offset_ : -1, cur_, bufs_.index(cur_));
+        if (seekable_) {
+            offsets_[cur_] = offset_;
+            offset_ += used_[cur_];
+        }
+        cur_ = (cur_ + 1) % depth;
+        while (busy_[cur_]) {
+            complete();
+        }
+    }
+
+    void complete()
+    {
+        uint64_t i;
+        ssize_t res;
+        io_->wait(i, res);
+        --in_flight_;
+        /* short writes, e.g. to a full pipe, are finished synchronously, as are cancelled ones */
+        if (isRetriable(res)) {
+            res = 0;
+        }
+        size_t done = res < 0 ? 0 : res;
+        while (res >= 0 && done < used_[i]) {
+            res = seekable_ ? pwrite(fd_, bufs_[i] + done, used_[i] - done, offsets_[i] + done)
+                            : ::write(fd_, bufs_[i] + done, used_[i] - done);
+            if (res < 0 && errno == EINTR) res = 0;
+            else if (res < 0) res = -errno;
+            else done += res;
+        }
+        if (res < 0) {
+            fprintf(stderr, "Error: failed to write output: %s\n", strerror(-res));
+            exit(EXIT_FAILURE);
+        }
+        used_[i] = 0;
+        busy_[i] = false;
+    }
+
+    int fd_;
+    std::unique_ptr<IoBackend> io_;
+    IoBuffers bufs_;
+    std::vector<size_t> used_;
+    std::vector<bool> busy_;
+    std::vector<off_t> offsets_ = std::vector<off_t>(depth, 0);
+    bool seekable_;
+    off_t offset_;
+    size_t cur_ = 0;
+    size_t in_flight_ = 0;
+};
+
+#endif /* io_backend_hpp */
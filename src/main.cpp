@@ -38,61 +38,661 @@
 #include <stdio.h>
 #include <assert.h>
 #include <thread>
+#include <functional>
+#include <future>
+#include <map>
+#include <sys/resource.h>
 #include <boost/program_options.hpp>
 #include "fasta.hpp"
 #include "fastq.hpp"
+#ifdef TO_SUPPORT_BAM
+#include "bam.hpp"
+#endif
 #include "thread.hpp"
+#include "results.hpp"
+#include "topology.hpp"
+#include "shard.hpp"
 #include "polyA_hmm_model.hpp"
 #include "kernel_color.h"
 
-/* send every 100 fasta entries to a thread each time */
-const int default_bulk_size = 100;
+/* batches of input are sized by their bases, see BatchSizer, up to this many records */
+const int k_max_batch_records = 1 << 16;
 
-/* buffer to hold std output in each thread, assuming each fasta (name + seq) is shorter than 50000 */
-constexpr int stdout_buffer_size = default_bulk_size * 50000;
+/* bases in a batch to start adaptive batch sizing from */
+const size_t k_default_batch_bases = 100000;
 
-/* buffer to hold log in each thread, assuming each fasta (name + polyA length) is shorter than 1000 */
-constexpr int stderr_buffer_size = default_bulk_size * 1000;
+/* batches of input to hand out the largest of first, see ReadAheadBlockQueue */
+const size_t k_default_lookahead = 16;
 
-/* default # of threads */
-const int default_num_threads = 8;
+/* the writer thread writes formatted output and log in multiples of this many bytes, the rest at the end */
+constexpr size_t k_flush_chunk = 1 << 20;
+
+/* default # of threads, for as many as the CPUs available, see availableCpus */
+const int default_num_threads = 0;
 
 /* distance in the header section of flnc file from "C" in "_CCS" to the first digit after "fiveend=" */
 const size_t k_header_distance1 = 57;
 
-/* mutex for io */
-std::mutex k_io_mx;
+/* # of output batches each worker can have waiting for the writer thread */
+constexpr size_t k_output_ring_size = 4;
+
+/* # of out-of-order batches per worker the writer holds back in ordered output */
+constexpr size_t k_reorder_window_per_worker = 4;
+
+/* # of written batches the writer keeps for each worker to reuse, with the capacity of their buffers */
+constexpr size_t k_free_batches_per_worker = 8;
+
+/* bytes of the Viterbi workspace of PolyAHmmMode::calculateVirtabi per base of a read, see --max-memory */
+constexpr size_t k_decode_bytes_per_base = PolyAHmmMode::nStates * sizeof(double) + sizeof(int);
+
+/* polyA tails written as training data are at least this long and this rich in A, following the filters of
+ * aux/C/extractSoftclipped.c and aux/python/pacb_aper_filter.py */
+constexpr size_t k_min_training_tail_length = 10;
+constexpr double k_min_training_tail_a = 0.75;
+
+/* stdout written through the io backend, nullptr for stdio */
+std::unique_ptr<AsyncFileSink> k_stdout_sink;
+
+/* classes of reads by their polyA tail, each of which can be written to a file of its own */
+enum ReadClass {
+    TRIMMED, /* with a polyA tail, written trimmed */
+    UNTOUCHED, /* without a polyA tail */
+    POLYA_ONLY, /* nothing but polyA, written as they are; dropped unless written to a file */
+    k_num_read_classes
+};
+
+/* FASTA files of training data for -a/-b taken from the reads with a polyA tail, see --polyA-tails-out */
+enum TrainingFile {
+    POLYA_TAILS = k_num_read_classes, /* their polyA tails */
+    NON_POLYA, /* the rest of them */
+    k_num_output_files
+};
+
+/* whether file is to be BGZF compressed, by its name */
+inline bool isGzFileName(const std::string& file) {
+    return file.size() > 3 && file.compare(file.size() - 3, 3, ".gz") == 0;
+}
+
+/* parse size, in bytes or with a K, M or G suffix of powers of 1024, into bytes; false if it is not one */
+inline bool parseSize(const std::string& size, size_t& bytes) {
+    char *end;
+    double n = strtod(size.c_str(), &end);
+    if (end == size.c_str() || n < 0)
+        return false;
+    switch (*end) {
+        case 'K': case 'k': n *= 1 << 10; ++end; break;
+        case 'M': case 'm': n *= 1 << 20; ++end; break;
+        case 'G': case 'g': n *= 1 << 30; ++end; break;
+    }
+    if (*end)
+        return false;
+    bytes = static_cast<size_t>(n);
+    return true;
+}
+
+/* output file other than stdout written through the io backend; compressed output is BGZF compressed by
+ * the workers, only its EOF block is written here */
+class OutputFile {
+public:
+    OutputFile(const std::string& file, IoBackendKind io, bool compressed)
+        : compressed_(compressed) {
+        fd_ = open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0) {
+            fprintf(stderr, "Error: cannot write to %s: %s\n", file.c_str(), strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        sink_.reset(new AsyncFileSink{fd_, io == IoBackendKind::STREAM ? IoBackendKind::SYNC : io, true});
+    }
+
+    ~OutputFile() {
+#ifdef TO_SUPPORT_BAM
+        if (compressed_)
+            sink_->write(k_bgzf_eof, k_bgzf_eof_size);
+#endif
+        sink_.reset();
+        close(fd_);
+    }
+
+    bool compressed() const {
+        return compressed_;
+    }
+
+    AsyncFileSink& sink() {
+        return *sink_;
+    }
+
+private:
+    bool compressed_;
+    int fd_;
+    std::unique_ptr<AsyncFileSink> sink_;
+};
+
+/* files of the classes of reads, nullptr for the default: stdout, or nowhere for POLYA_ONLY; and of the
+ * training data, nullptr for none */
+std::unique_ptr<OutputFile> k_output_files[k_num_output_files];
+
+/* file of the per-read results, see --results; nullptr to log them to stderr */
+std::unique_ptr<OutputFile> k_results_file;
+
+/* work done by one worker, see --pin */
+struct WorkerSummary {
+    int cpu = -1; /* pinned to, -1 if not */
+    int node = 0; /* NUMA node of cpu */
+    uint64_t reads = 0;
+    uint64_t bases = 0;
+    double busy_seconds = 0; /* processing batches rather than waiting for them or the writer */
+    uint64_t allocations = 0; /* by operator new */
+};
+
+/* latencies of the reads, from a read being complete in the input to its output being flushed, see --max-latency;
+ * in buckets of an eighth of a power of 2 microseconds, so quantiles are within 10% */
+class LatencyHistogram {
+public:
+    void add(std::chrono::steady_clock::duration latency, uint64_t reads) {
+        double us = std::chrono::duration<double, std::micro>(latency).count();
+        int bucket = us < 1 ? 0 : std::min(k_buckets - 1, 1 + static_cast<int>(std::log2(us) * k_per_doubling));
+        counts_[bucket] += reads;
+        total_ += reads;
+        max_ = std::max(max_, us);
+    }
+
+    uint64_t reads() const {
+        return total_;
+    }
+
+    /* in milliseconds, the upper bound of the bucket of the q-th quantile */
+    double quantile(double q) const {
+        uint64_t rank = static_cast<uint64_t>(std::ceil(q * total_));
+        uint64_t seen = 0;
+        for (int b = 0; b < k_buckets; ++b) {
+            seen += counts_[b];
+            if (seen >= rank && seen)
+                return std::min(max_, std::exp2(static_cast<double>(b) / k_per_doubling)) / 1000;
+        }
+        return max_ / 1000;
+    }
+
+    double max() const {
+        return max_ / 1000;
+    }
+
+private:
+    constexpr static int k_per_doubling = 8;
+    constexpr static int k_buckets = 48 * k_per_doubling; /* up to 2^47 us */
+    uint64_t counts_[k_buckets] = {};
+    uint64_t total_ = 0;
+    double max_ = 0; /* in microseconds */
+};
+
+/* counters reported in the run summary, see --summary */
+struct RunSummary {
+    std::atomic<uint64_t> reads{0};
+    std::atomic<uint64_t> reads_trimmed{0}; /* with a polyA tail */
+    std::atomic<uint64_t> reads_polyA_only{0}; /* with nothing but polyA */
+    QueueStats input; /* of the queue of input blocks */
+    uint64_t batch_bases = 0; /* bases per batch at the end, see BatchSizer */
+    std::atomic<uint64_t> writer_stalls{0}; /* times a worker found its output ring full */
+    std::atomic<uint64_t> writer_stall_us{0}; /* time workers waited for the writer thread */
+    std::atomic<uint64_t> reorder_peak{0}; /* most batches held back at once in ordered output */
+    double writer_seconds = 0; /* the writer thread spent writing */
+    uint64_t memory_waits = 0; /* times the input waited for memory, see MemoryBudget */
+    uint64_t memory_peak = 0; /* most bytes taken by batches in flight at once */
+    LatencyHistogram latency; /* of the reads in streaming mode, written by the writer thread */
+    std::vector<WorkerSummary> workers; /* sized before the workers start, each writes its own */
+} k_summary;
+
+#ifdef TO_COUNT_ALLOCATIONS
+/* see allocations.cpp */
+extern thread_local uint64_t t_allocations;
+
+inline uint64_t threadAllocations() {
+    return t_allocations;
+}
+#else
+inline uint64_t threadAllocations() {
+    return 0;
+}
+#endif
 
+/* write the run summary as "key\tvalue" lines to file */
+void writeSummary(const std::string& file);
 
+/* write to stdout; only the writer thread does so while the workers run */
+void writeStdout(const char *buf, size_t n) {
+    if (k_stdout_sink)
+        k_stdout_sink->write(buf, n);
+    else
+        fwrite(buf, 1, n, stdout);
+}
+
+/* write the slices in iov to stdout without copying them and clear it; see writeStdout above */
+void writeStdout(std::vector<iovec>& iov) {
+    if (k_stdout_sink) {
+        k_stdout_sink->writev(iov.data(), iov.size());
+    } else {
+        fflush(stdout);
+        writevFully(STDOUT_FILENO, iov.data(), iov.size(), -1);
+    }
+    iov.clear();
+}
+
+
+using fasta_t = Fasta<caseInsensitiveString>;
 using fastq_t = Fastq<caseInsensitiveString>;
+#ifdef TO_SUPPORT_BAM
+using bam_t = Bam<caseInsensitiveString>;
+#endif
+
+/* what the workers write to stdout */
+enum class OutputMode {
+    TRIM, /* trimmed records in the format of input */
+    COLOR, /* records with polyA colored */
+    ANNOTATE, /* only the polyA length of each record, see --annotate */
+    BAM /* trimmed records as unaligned BAM, tagged with the polyA length */
+};
+
+/* options deciding how the input is trimmed */
+struct TrimOptions {
+    int num_thread;
+    bool show_color;
+    bool generic_format;
+    bool bam_output;
+    IoBackendKind io;
+    std::string summary_file;
+    bool ordered;
+    std::string annotate; /* "name" or "ordinal" to only annotate the records with their polyA length */
+    bool score;
+    std::string output_files[k_num_output_files]; /* see ReadClass and TrainingFile, empty for the default */
+    std::string results_file; /* per-read results, see results.hpp, instead of the log on stderr */
+    size_t batch_bases; /* 0 to size batches adaptively, see BatchSizer */
+    size_t lookahead; /* blocks of input to hand out the largest of first, see ReadAheadBlockQueue */
+    int compress_threads; /* of the compression stage, see StagePool; 0 for the workers to compress alone */
+    size_t max_memory; /* bytes the batches in flight may take, 0 for no limit, see MemoryBudget */
+    int max_latency; /* ms a read may wait for the rest of its batch in streaming mode, 0 if not streaming */
+    bool results_binary;
+    bool pin; /* pin the workers to CPUs, see pinningOrder */
+    int shard_index; /* of the part of the input to trim, from 0, see shard.hpp */
+    int shard_count; /* 0 to trim all of the input */
+};
 
 void setDefaultHMM(PolyAHmmMode&);
 
+/* detect the format of the input and trim it */
+template <class Reader>
+int trimInput(const PolyAHmmMode&, Reader&, const TrimOptions&, const std::string&);
+
+/* trim the records of shard opts.shard_index of the input */
+int trimShard(const PolyAHmmMode&, const TrimOptions&, const std::string&);
+
+/* merge the outputs, or the summaries, of the shards of a run; argv[0] is "merge" */
+int mergeMain(int argc, const char *argv[]);
+
+/* run the workers on input records of type T; bam_header is that of BAM input */
+template <class T, class Reader>
+void trim(const PolyAHmmMode&, Reader&, const TrimOptions&, const std::string& bam_header = "");
+
 /* Iso-Seq specific stuff */
 void adjustHeader(std::string&, size_t);
 
-/* thread worker*/
-template <class MTQ, bool showColor, bool isoSeqFormat>
+/* output of a batch of records, handed from a worker to the writer thread */
+template <class Container>
+struct OutputBatch {
+    BlockPosition pos; /* of the records in the input */
+    std::string block; /* input block of the records, trimmed records are written as slices of it */
+    Container data; /* the records, which iov may also point to */
+    std::vector<iovec> iov; /* trimmed records, see write_policy::gather */
+    OutputArena out; /* formatted, or BGZF compressed, records */
+    OutputArena log; /* per-read polyA length for stderr, or results for k_results_file */
+    struct {
+        std::vector<iovec> iov;
+        OutputArena out; /* formatted, or BGZF compressed, records */
+    } files[k_num_output_files]; /* records for the files of their class, or training data, see k_output_files */
+    size_t charged = 0; /* bytes of the MemoryBudget taken by the batch, given back once it is written */
+    size_t retained = 0; /* bytes of the MemoryBudget taken by its buffers while it waits to be reused */
+    int worker = 0; /* index of the worker which filled the batch, and gets it back to reuse, see Writer::reuse */
+
+    /* empty the batch to be reused, keeping the capacity of its buffers; the records are kept to be read into */
+    void clear() {
+        charged = 0;
+        iov.clear();
+        out.clear();
+        log.clear();
+        for (auto& file : files) {
+            file.iov.clear();
+            file.out.clear();
+        }
+    }
+
+    /* bytes of the buffers kept by clear(), short of those of the strings of the records */
+    size_t capacity() const {
+        size_t n = block.capacity() + iov.capacity() * sizeof(iovec) + out.capacity() + log.capacity();
+        for (const auto& file : files)
+            n += file.iov.capacity() * sizeof(iovec) + file.out.capacity();
+        return n;
+    }
+};
+
+/* the only thread writing to stdout, stderr and the other output files while the workers run; each worker hands its batches over
+ * through its own lock-free ring, so workers only wait when their ring is full, i.e. the writer stalls.
+ * Ordered output holds batches arriving early in a bounded window until those before them are written;
+ * once the window is full, only the next batch in order is taken off the rings, the other workers stall */
+template <class Batch>
+class Writer {
+public:
+    using ring_type = SpscRing<std::unique_ptr<Batch>, k_output_ring_size>;
+
+    /* lookahead: blocks of input may be handed out this many blocks early, see ReadAheadBlockQueue */
+    /* streaming: flush the output as soon as it is written, see flush() */
+    Writer(int num_workers, bool ordered, size_t lookahead, MemoryBudget& budget, bool streaming = false)
+        : rings_(num_workers), free_(num_workers), budget_(budget), pushing_(num_workers), ordered_(ordered),
+          streaming_(streaming),
+          window_(num_workers * k_reorder_window_per_worker + lookahead) {
+        for (auto& seq : pushing_)
+            seq.store(k_not_pushing);
+    }
+
+    Writer(const Writer&) = delete;
+
+    Writer& operator=(const Writer&) = delete;
+
+    /* called by worker i only */
+    void push(int i, std::unique_ptr<Batch>& batch) {
+        batch->worker = i;
+        if (!rings_[i].push(batch)) {
+            auto start = std::chrono::steady_clock::now();
+            pushing_[i].store(batch->pos.seq);
+            do {
+                space_.wait();
+            } while (!rings_[i].push(batch));
+            pushing_[i].store(k_not_pushing);
+            k_summary.writer_stalls += 1;
+            k_summary.writer_stall_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        work_.ring();
+    }
+
+    /* called by worker i only; a batch it filled and was written already, to be reused, or a new one. Batches go
+     * back to the worker which filled them, so that with --pin their buffers stay on the node of its CPU */
+    std::unique_ptr<Batch> reuse(int i) {
+        std::unique_ptr<Batch> batch;
+        if (free_[i].pop(batch)) {
+            budget_.unkeep(batch->retained); /* charged again as it is filled */
+            batch->retained = 0;
+        } else {
+            batch.reset(new Batch);
+        }
+        return batch;
+    }
+
+    /* called once all workers are done; the writer thread returns after draining the rings */
+    void finish() {
+        done_.store(true);
+        work_.ring();
+    }
+
+    void operator()() {
+        std::unique_ptr<Batch> batch;
+        while (true) {
+            bool done = done_.load(); /* anything pushed before done is drained below */
+            size_t n = 0;
+            for (auto& ring : rings_) {
+                while (!windowFull() && ring.pop(batch)) {
+                    take(batch);
+                    ++n;
+                }
+                /* a full window only lets in the batch it is waiting for, which is at the front of its ring */
+                for (std::unique_ptr<Batch> *front; (front = ring.front()) && (*front)->pos.seq == next_seq_; ++n) {
+                    ring.pop(batch);
+                    take(batch);
+                }
+            }
+            n += unblock();
+            if (n && streaming_)
+                flush();
+            if (n)
+                space_.ring();
+            else if (done)
+                break;
+            else
+                work_.wait();
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (auto& held : held_) /* only if a batch never came */
+            write(*held.second);
+        writeStdout(out_.data(), out_.size());
+        writeLog(log_.data(), log_.size());
+        fflush(stderr);
+        budget_.unkeep(arenas_);
+        arenas_ = 0;
+        k_summary.writer_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    /* write batch, or hold it back until the batches before it are written */
+    void take(std::unique_ptr<Batch>& batch) {
+        if (!ordered_) {
+            write(*batch);
+            recycle(batch);
+            return;
+        }
+        uint64_t seq = batch->pos.seq;
+        held_.emplace(seq, std::move(batch));
+        if (held_.size() > k_summary.reorder_peak)
+            k_summary.reorder_peak = held_.size();
+        for (auto it = held_.begin(); it != held_.end() && it->first == next_seq_; it = held_.erase(it)) {
+            write(*it->second);
+            recycle(it->second);
+            ++next_seq_;
+        }
+    }
+
+    /* give the memory of batch, written, back and hand it back to the worker which filled it, charging the
+     * capacity of its buffers while it waits; dropped if enough are waiting to be reused by that worker or
+     * keeping it would go over the memory limit */
+    void recycle(std::unique_ptr<Batch>& batch) {
+        budget_.release(batch->charged);
+        batch->clear();
+        size_t retained = batch->capacity();
+        if (!budget_.fits(retained)) {
+            batch.reset();
+            return;
+        }
+        budget_.keep(retained);
+        batch->retained = retained;
+        if (!free_[batch->worker].push(batch)) {
+            budget_.unkeep(retained);
+            batch.reset();
+        }
+    }
+
+    static void writeLog(const char *buf, size_t n) {
+        if (k_results_file)
+            k_results_file->sink().write(buf, n);
+        else
+            fwrite(buf, 1, n, stderr);
+    }
+
+    /* with input handed out of order, a worker may have later batches in its ring ahead of the one the full
+     * window waits for, or waiting to be pushed behind them; its ring is drained past the window, by at most
+     * its size, until that batch is written */
+    size_t unblock() {
+        size_t n = 0;
+        for (size_t i = 0; windowFull() && i < rings_.size(); ++i) {
+            uint64_t seq = next_seq_;
+            if (pushing_[i].load() != seq && !holds(rings_[i], seq))
+                continue;
+            std::unique_ptr<Batch> batch;
+            while (next_seq_ == seq) {
+                if (rings_[i].pop(batch)) {
+                    take(batch);
+                    space_.ring();
+                    ++n;
+                } else {
+                    work_.wait();
+                }
+            }
+        }
+        return n;
+    }
+
+    static bool holds(ring_type& ring, uint64_t seq) {
+        std::unique_ptr<Batch> *batch;
+        for (size_t i = 0; (batch = ring.at(i)) != nullptr; ++i) {
+            if ((*batch)->pos.seq == seq)
+                return true;
+        }
+        return false;
+    }
+
+    bool windowFull() const {
+        return ordered_ && held_.size() >= window_;
+    }
+
+    /* streaming mode: write out the output gathered so far, through the buffers of stdio and the io backend, and
+     * take the latency of its reads */
+    void flush() {
+        writeStdout(out_.data(), out_.size());
+        out_.clear();
+        writeLog(log_.data(), log_.size());
+        log_.clear();
+        if (k_stdout_sink)
+            k_stdout_sink->flush();
+        else
+            fflush(stdout);
+        for (auto& file : k_output_files) {
+            if (file)
+                file->sink().flush();
+        }
+        if (k_results_file)
+            k_results_file->sink().flush();
+        else
+            fflush(stderr);
+        auto now = std::chrono::steady_clock::now();
+        for (const auto& batch : unflushed_)
+            k_summary.latency.add(now - batch.first, batch.second);
+        unflushed_.clear();
+    }
+
+    void write(Batch& batch) {
+        auto start = std::chrono::steady_clock::now();
+        if (streaming_)
+            unflushed_.emplace_back(batch.pos.ready, batch.data.size());
+        if (!batch.iov.empty())
+            writeStdout(batch.iov);
+        out_.append(batch.out.data(), batch.out.size());
+        if (out_.size() >= k_flush_chunk) {
+            size_t n = out_.size() / k_flush_chunk * k_flush_chunk;
+            writeStdout(out_.data(), n);
+            out_.consume(n);
+        }
+        for (int c = 0; c < k_num_output_files; ++c) {
+            if (!batch.files[c].iov.empty()) {
+                k_output_files[c]->sink().writev(batch.files[c].iov.data(), batch.files[c].iov.size());
+                batch.files[c].iov.clear();
+            }
+            if (!batch.files[c].out.empty())
+                k_output_files[c]->sink().write(batch.files[c].out.data(), batch.files[c].out.size());
+        }
+        log_.append(batch.log.data(), batch.log.size());
+        if (log_.size() >= k_flush_chunk) {
+            size_t n = log_.size() / k_flush_chunk * k_flush_chunk;
+            writeLog(log_.data(), n);
+            log_.consume(n);
+        }
+        size_t arenas = out_.capacity() + log_.capacity(); /* kept to the end, charged as they grow */
+        if (arenas > arenas_) {
+            budget_.keep(arenas - arenas_);
+            arenas_ = arenas;
+        }
+        k_summary.writer_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    constexpr static uint64_t k_not_pushing = ~0ull;
+
+    std::vector<ring_type> rings_;
+    std::vector<SpscRing<std::unique_ptr<Batch>, k_free_batches_per_worker> > free_; /* per worker, see reuse() */
+    MemoryBudget& budget_;
+    std::vector<std::atomic<uint64_t> > pushing_; /* seq of the batch worker i waits to push, see unblock() */
+    bool ordered_;
+    bool streaming_;
+    std::vector<std::pair<std::chrono::steady_clock::time_point, size_t> > unflushed_; /* ready time, reads */
+    size_t window_;
+    std::map<uint64_t, std::unique_ptr<Batch> > held_; /* batches written once next_seq_ gets to them */
+    uint64_t next_seq_ = 0;
+    OutputArena out_; /* formatted output and log gathered from the batches to be written in large chunks */
+    OutputArena log_;
+    size_t arenas_ = 0; /* bytes of the MemoryBudget taken by out_ and log_ */
+    Doorbell work_; /* a ring is no longer empty */
+    Doorbell space_; /* a ring is no longer full */
+    std::atomic<bool> done_{false};
+};
+
+/* thread worker; the format of output follows that of the input, see write_policy, unless it is BAM or
+ * only annotated with the polyA length. A worker parses, decodes and formats its batch read by read, while each
+ * read is in cache; only BGZF compression, whose cost does not follow that of the reads, is handed to a
+ * StagePool of its own */
+template <class MTQ, OutputMode outputMode, bool isoSeqFormat>
 class Worker {
     using multi_thread_safe_queue_type = MTQ;
     using container_type = typename multi_thread_safe_queue_type::container_type;
+    using record_type = typename container_type::value_type;
 public:
-    Worker(const PolyAHmmMode& hmm, multi_thread_safe_queue_type& producer)
-        : hmm_(hmm), producer_(producer) {}
+    using producer_type = multi_thread_safe_queue_type;
+    using batch_type = OutputBatch<container_type>;
+    using writer_type = Writer<batch_type>;
+
+    /* fields of the records the output needs, see RecordFields; the quality is left in the input block */
+    static constexpr unsigned fields = outputMode == OutputMode::ANNOTATE ? 0 : k_field_quality;
+
+    Worker(const PolyAHmmMode& hmm, multi_thread_safe_queue_type& producer, writer_type& writer, BatchSizer& sizer,
+           StagePool& compressor, MemoryBudget& budget, int index, const TrimOptions& opts)
+        : hmm_(hmm), producer_(producer), writer_(writer), sizer_(sizer), compressor_(compressor), budget_(budget),
+          index_(index),
+          annotate_ordinal_(opts.annotate == "ordinal"), annotate_score_(opts.score),
+          results_(!opts.results_file.empty()), results_binary_(opts.results_binary) {
+        for (size_t i = 0; i < PolyAHmmMode::nSymbol; ++i)
+            log_odds_[i] = std::log2(hmm_.emitProb(PolyAHmmMode::States::POLYA, i) /
+                                     hmm_.emitProb(PolyAHmmMode::States::NONPOLYA, i));
+    }
 
     Worker(const Worker& other)
-        : hmm_(other.hmm_), producer_(other.producer_) {}
+        : hmm_(other.hmm_), producer_(other.producer_), writer_(other.writer_), sizer_(other.sizer_),
+          compressor_(other.compressor_), budget_(other.budget_),
+          index_(other.index_),
+          annotate_ordinal_(other.annotate_ordinal_), annotate_score_(other.annotate_score_),
+          results_(other.results_), results_binary_(other.results_binary_) {
+        std::copy(other.log_odds_, other.log_odds_ + PolyAHmmMode::nSymbol, log_odds_);
+    }
 
     Worker& operator=(const Worker&) = delete;
 
     void operator()() {
-        auto data = producer_.get();
-        char *stdout_buf = (char *) malloc(stdout_buffer_size);
-        char *stderr_buf = (char *) malloc(stderr_buffer_size);
-        size_t stdout_buff_off{0}, stderr_buff_off{0};
-        while (!data.empty()) {
+        using clock = std::chrono::steady_clock;
+        std::unique_ptr<batch_type> batch = writer_.reuse(index_);
+        clock::time_point asked = clock::now();
+        uint64_t allocations = threadAllocations();
+        producer_.get(batch->data, batch->block, batch->pos);
+        clock::time_point got = clock::now();
+        OutputArena bam_records; /* encoded before they are compressed into the batch */
+        OutputArena file_records[k_num_output_files]; /* formatted before they are compressed into the batch */
+        uint64_t reads{0}, reads_trimmed{0}, reads_polyA_only{0}, total_bases{0};
+        double busy{0};
+        size_t out_size{0}, log_size{0}; /* of the last batch, to size the next one */
+        size_t retained{0}; /* bytes of the MemoryBudget taken by the Viterbi workspace and the arenas above, which
+                             * keep the capacity they grow to until the worker is done */
+        while (!batch->data.empty()) {
+            batch->out.reserve(out_size);
+            batch->log.reserve(log_size);
             size_t polyalen;
-            for (auto& fq : data) {
+            size_t bases = 0;
+            uint64_t ordinal = batch->pos.first;
+            size_t longest = 0;
+            for (const auto& fq : batch->data)
+                longest = std::max<size_t>(longest, fq.size());
+            chargeRetained(retained, longest, bam_records, file_records); /* before the workspace grows to decode it */
+            for (auto& fq : batch->data) {
+                bases += fq.size();
                 const Matrix<int>& path = hmm_.calculateVirtabi(fq.seq_.rbegin(), fq.seq_.size());
                 for (polyalen = 0; polyalen < path.size();
                      ++polyalen) { /* cannot use binary search because polyA might appear in the middle */
@@ -100,67 +700,216 @@ public:
                         break;
                     }
                 }
+                ++reads;
+                reads_trimmed += polyalen > 0;
+                bool polyA_only = polyalen && polyalen == fq.size(); /* an empty read has no tail either */
+                reads_polyA_only += polyA_only;
+                if (k_output_files[POLYA_TAILS] && isTrainingTail(fq, polyalen)) {
+                    addFasta(*batch, file_records, POLYA_TAILS, fq, fq.size() - polyalen, polyalen);
+                    addFasta(*batch, file_records, NON_POLYA, fq, 0, fq.size() - polyalen);
+                }
+                if (outputMode == OutputMode::TRIM && polyA_only && k_output_files[POLYA_ONLY])
+                    route(*batch, file_records, POLYA_ONLY, fq, 0, true); /* as it is, before its header is adjusted */
+                if (outputMode == OutputMode::ANNOTATE) { // static decision; the record itself is left as it is
+                    annotate(batch->out, fq, ordinal++, polyalen);
+                    continue;
+                }
                 if (isoSeqFormat) { // static decision
                     if (polyalen)
                         adjustHeader(fq.name_, polyalen);
                 }
-                stderr_buff_off += sprintf(stderr_buf + stderr_buff_off, "%s\t%zu\n", fq.name_.c_str(), polyalen);
-                if (stderr_buff_off * 5 > stderr_buffer_size * 4) {
-                    /* manually flush stderr */
-                    std::lock_guard<std::mutex> lock(k_io_mx);
-                    fwrite(stderr_buf, 1, stderr_buff_off, stderr);
-                    stderr_buff_off = 0;
+                if (results_) {
+                    appendResult(batch->log, fq.name_, fq.size(), polyalen, results_binary_);
+                } else {
+                    batch->log.append(fq.name_);
+                    batch->log.append('\t');
+                    batch->log.appendNumber(polyalen);
+                    batch->log.append('\n');
                 }
 
-                if (showColor) { // static decision; always print
-                    stdout_buff_off += sprintf(stdout_buf + stdout_buff_off
-                                               , "@%s\n"
-                                                 "%s" KERNAL_RED "%s" KERNAL_RESET
-                                                 "\n+\n%s" KERNAL_RED "%s\n" KERNAL_RESET
-                                               , fq.name_.c_str()
-                                               , fq.seq_.substr(0, fq.seq_.size() - polyalen).c_str()
-                                               , fq.seq_.substr(fq.seq_.size() - polyalen).c_str()
-                                               , fq.quality_.substr(0, fq.quality_.size() - polyalen).c_str()
-                                               , fq.quality_.substr(fq.quality_.size() - polyalen).c_str()
-                    );
+                if (outputMode == OutputMode::COLOR) { // static decision; always print
+                    write_policy<record_type>::writeColor(batch->out, fq, polyalen);
                 }
-                if (!showColor) { // static decision
+                if (outputMode == OutputMode::TRIM || outputMode == OutputMode::BAM) { // static decision
                     if (polyalen < fq.size()) { // print only when there are at least some non-polyA region
-                        stdout_buff_off += sprintf(stdout_buf + stdout_buff_off
-                                                   , "@%s\n%s\n+\n%s\n"
-                                                   , fq.name_.c_str()
-                                                   , fq.seq_.substr(0, fq.seq_.size() - polyalen).c_str()
-                                                   , fq.quality_.substr(0, fq.quality_.size() - polyalen).c_str()
-                        );
+#ifdef TO_SUPPORT_BAM
+                        if (outputMode == OutputMode::BAM) // static decision
+                            bam_write_policy<record_type>::write(bam_records, fq, polyalen);
+                        else
+#endif
+                        if (outputMode == OutputMode::TRIM && k_output_files[polyalen ? TRIMMED : UNTOUCHED])
+                            route(*batch, file_records, polyalen ? TRIMMED : UNTOUCHED, fq, polyalen);
+                        else
+                            write_policy<record_type>::gather(batch->iov, fq, polyalen);
                     }
                 }
-                if (stdout_buff_off * 5 > stdout_buffer_size * 4) {
-                    /* manually flush stdout */
-                    std::lock_guard<std::mutex> lock(k_io_mx);
-                    fwrite(stdout_buf, 1, stdout_buff_off, stdout);
-                    stdout_buff_off = 0;
-                }
             } /* end of for loop to process each fasta in data */
-            {
-                /* flush buffer */
-                std::lock_guard<std::mutex> lock(k_io_mx);
-                fwrite(stdout_buf, 1, stdout_buff_off, stdout);
-                fwrite(stderr_buf, 1, stderr_buff_off, stderr);
+#ifdef TO_SUPPORT_BAM
+            for (int c = 0; c < k_num_output_files; ++c) {
+                if (k_output_files[c] && k_output_files[c]->compressed() && !file_records[c].empty()) {
+                    compress(file_records[c].data(), file_records[c].size(), batch->files[c].out);
+                    file_records[c].clear();
+                }
             }
-            stdout_buff_off = stderr_buff_off = 0;
-            data = producer_.get(); /* get new chulk of data */
+#endif
+#ifdef TO_SUPPORT_BAM
+            if (outputMode == OutputMode::BAM) { // static decision
+                compress(bam_records.data(), bam_records.size(), batch->out);
+                bam_records.clear();
+            }
+#endif
+            out_size = batch->out.size();
+            log_size = batch->log.size();
+            chargeRetained(retained, longest, bam_records, file_records);
+            batch->charged = batch->block.size() + outputSize(*batch); /* the block was charged when it was read */
+            budget_.charge(outputSize(*batch));
+            double seconds = std::chrono::duration<double>(clock::now() - got).count();
+            sizer_.record(batch->block.size(), bases, seconds, std::chrono::duration<double>(got - asked).count());
+            total_bases += bases;
+            busy += seconds;
+            writer_.push(index_, batch);
+            batch = writer_.reuse(index_);
+            asked = clock::now();
+            producer_.get(batch->data, batch->block, batch->pos); /* get new chulk of data, into the records of an old one */
+            got = clock::now();
         }
-        free(stdout_buf);
-        free(stderr_buf);
+        budget_.unkeep(retained);
+        k_summary.reads += reads;
+        k_summary.reads_trimmed += reads_trimmed;
+        k_summary.reads_polyA_only += reads_polyA_only;
+        WorkerSummary& summary = k_summary.workers[index_];
+        summary.reads = reads;
+        summary.bases = total_bases;
+        summary.busy_seconds = busy;
+        summary.allocations = threadAllocations() - allocations;
     }
 
 private:
+    /* add fq, trimmed, to the file of its class c, see k_output_files; records whose header is yet to be
+     * adjusted are copied since gathered slices would see the adjusted one */
+    void route(batch_type& batch, OutputArena *file_records, ReadClass c, const record_type& fq, size_t trimmed,
+               bool copy = false) {
+        if (copy || k_output_files[c]->compressed())
+            write_policy<record_type>::write(records(batch, file_records, c), fq, trimmed);
+        else
+            write_policy<record_type>::gather(batch.files[c].iov, fq, trimmed);
+    }
+
+#ifdef TO_SUPPORT_BAM
+    /* bytes of output each task of the compression stage compresses, in whole BGZF blocks */
+    constexpr static size_t k_compress_task_size = 16 * k_bgzf_block_data_size;
+
+    /* compress [b, b + n) into BGZF blocks appended to out, as compressBgzf, split into tasks of the compression
+     * stage if it has threads of its own */
+    void compress(const char *b, size_t n, OutputArena& out) {
+        if (!compressor_.size() || n <= k_compress_task_size) {
+            compressBgzf(b, n, out);
+            return;
+        }
+        size_t tasks = (n + k_compress_task_size - 1) / k_compress_task_size;
+        if (chunks_.size() < tasks)
+            chunks_.resize(tasks);
+        TaskGroup group;
+        for (size_t i = 0; i < tasks; ++i) {
+            size_t off = i * k_compress_task_size; /* the blocks are those of compressBgzf on the whole */
+            OutputArena& chunk = chunks_[i];
+            chunk.clear();
+            compressor_.submit(group, [b, n, off, &chunk]() {
+                compressBgzf(b + off, n - off < k_compress_task_size ? n - off : k_compress_task_size, chunk);
+            });
+        }
+        compressor_.wait(group);
+        for (size_t i = 0; i < tasks; ++i)
+            out.append(chunks_[i].data(), chunks_[i].size());
+    }
+#endif
+
+    /* charge the growth of the memory the worker keeps to the end, of retained bytes so far: the Viterbi workspace,
+     * for reads of up to longest bases, and the arenas records are formatted in */
+    void chargeRetained(size_t& retained, size_t longest, const OutputArena& bam_records,
+                        const OutputArena *file_records) {
+        size_t n = std::max(hmm_.virtabiCapacity(), longest * k_decode_bytes_per_base) + bam_records.capacity();
+        for (int c = 0; c < k_num_output_files; ++c)
+            n += file_records[c].capacity();
+        if (n > retained) {
+            budget_.keep(n - retained);
+            retained = n;
+        }
+    }
+
+    /* bytes of the output buffers of batch, by their capacity */
+    static size_t outputSize(const batch_type& batch) {
+        size_t n = batch.out.capacity() + batch.log.capacity() + batch.iov.capacity() * sizeof(iovec);
+        for (const auto& file : batch.files)
+            n += file.out.capacity() + file.iov.capacity() * sizeof(iovec);
+        return n;
+    }
+
+    /* where records for file f are formatted: the batch, or file_records to compress them first */
+    static OutputArena& records(batch_type& batch, OutputArena *file_records, int f) {
+        return k_output_files[f]->compressed() ? file_records[f] : batch.files[f].out;
+    }
+
+    /* whether the polyA tail of fq, of length polyalen, is good for training, along with the rest of fq */
+    static bool isTrainingTail(const record_type& fq, size_t polyalen) {
+        if (polyalen < k_min_training_tail_length || polyalen == fq.size())
+            return false;
+        size_t a = 0;
+        for (size_t i = fq.size() - polyalen; i < fq.size(); ++i)
+            a += (fq.seq_[i] & ~0x20) == 'A';
+        return a >= k_min_training_tail_a * polyalen;
+    }
+
+    /* add n nucleotides of fq from pos, as FASTA named after fq, to training file f */
+    static void addFasta(batch_type& batch, OutputArena *file_records, TrainingFile f, const record_type& fq,
+                         size_t pos, size_t n) {
+        OutputArena& out = records(batch, file_records, f);
+        out.append('>');
+        out.append(fq.name_);
+        out.append('\n');
+        out.append(fq.seq_.data() + pos, n);
+        out.append('\n');
+    }
+
+    /* append "name|ordinal<tab>polyA length[<tab>score]" of fq to out; the score is the log2 odds of its
+     * polyA tail under the polyA over the non-polyA emissions */
+    void annotate(OutputArena& out, const record_type& fq, uint64_t ordinal, size_t polyalen) {
+        if (annotate_ordinal_)
+            out.appendNumber(ordinal);
+        else
+            out.append(fq.name_);
+        out.append('\t');
+        out.appendNumber(polyalen);
+        if (annotate_score_) {
+            double score = 0;
+            for (size_t i = fq.seq_.size() - polyalen; i < fq.seq_.size(); ++i)
+                score += log_odds_[to_idx[static_cast<unsigned char>(fq.seq_[i]) & 127]];
+            char buf[32];
+            out.append('\t');
+            out.append(buf, snprintf(buf, sizeof(buf), "%.2f", score));
+        }
+        out.append('\n');
+    }
+
     PolyAHmmMode hmm_;
     /* keep a COPY of the HMM model since it does mutable calculation inside the class */
     multi_thread_safe_queue_type& producer_;
+    writer_type& writer_;
+    BatchSizer& sizer_;
+    StagePool& compressor_;
+    MemoryBudget& budget_;
+    std::vector<OutputArena> chunks_; /* compressed by the tasks of compress() */
+    int index_;
+    bool annotate_ordinal_;
+    bool annotate_score_;
+    bool results_;
+    bool results_binary_;
+    double log_odds_[PolyAHmmMode::nSymbol];
 };
 
 int main(int argc, const char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "merge") == 0)
+        return mergeMain(argc - 1, argv + 1);
     boost::program_options::options_description
         opts(R"(this program trims the polyA tail specifically from the 3' ends of fasta files)");
     /** options **/
@@ -169,15 +918,18 @@ int main(int argc, const char *argv[]) {
     std::string train_polya_file;
     std::string train_nonpolya_file;
     std::string train_model_file;
-    int num_thread;
-    bool show_color;
-    bool generic_format;
+    TrimOptions trim_opts;
+    std::string io_backend;
+    std::string max_memory;
+    std::string shard;
     try {
         opts.add_options()
                 ("help,h", "display this help message and exit")
                 ("input,i"
                  , boost::program_options::value<std::string>(&input_fq_file)->required()
-                 , "The input fastq file with polyA, can be compressed by gzip or bzip2")
+                 , "The input fastq or fasta file with polyA, can be compressed by gzip or bzip2; "
+                   "the format is detected automatically and kept in the output. "
+                   "BGZF compressed input and unaligned BAM, written as fastq, are decompressed in parallel")
                 ("model,m"
                  , boost::program_options::value<std::string>(&model_file)->default_value("")
                  , "HMM model file to use; if not specified, will use default values")
@@ -191,16 +943,112 @@ int main(int argc, const char *argv[]) {
                  , boost::program_options::value<std::string>(&train_model_file)->default_value("")
                  , "New trained model file to output")
                 ("color,c"
-                 , boost::program_options::bool_switch(&show_color)
+                 , boost::program_options::bool_switch(&trim_opts.show_color)
                  , "To color polyA sequences in the output instead of trimming away them")
                 ("thread,t"
-                 , boost::program_options::value<int>(&num_thread)->default_value(default_num_threads)
-                 , "Number of threads to use")
+                 , boost::program_options::value<int>(&trim_opts.num_thread)->default_value(default_num_threads)
+                 , "Number of threads to use; 0 for as many as the CPUs available to the process, by its "
+                   "affinity mask and cgroup CPU quota")
+                ("batch-bases"
+                 , boost::program_options::value<size_t>(&trim_opts.batch_bases)->default_value(0)
+                 , "Number of bases in each batch of reads handed to a thread; "
+                   "0 to size batches at runtime from the measured time to process them, "
+                   "aiming at about 1% of that time spent getting them")
+                ("lookahead"
+                 , boost::program_options::value<size_t>(&trim_opts.lookahead)->default_value(k_default_lookahead)
+                 , "Number of batches read ahead to hand out the largest of first, so that long reads are not "
+                   "left to the end of the run; 0 to hand them out in the order of the input. "
+                   "The order of --ordered output is kept")
+                ("compress-threads"
+                 , boost::program_options::value<int>(&trim_opts.compress_threads)->default_value(0)
+                 , "Number of threads of their own for the BGZF compression of --bam and .gz output, which the "
+                   "workers hand batches over to in parts of 16 blocks and help with while they wait; "
+                   "0 for the workers to compress their own batches")
+                ("max-memory"
+                 , boost::program_options::value<std::string>(&max_memory)->default_value("0")
+                 , "Memory the batches in flight may take, from the input read to the output written, e.g. 2G; "
+                   "once it is taken, the input is not read further until batches are written. Approximate: "
+                   "the buffers of batches, workers and the writer are counted, not the strings of the records "
+                   "nor allocator overhead. 0 for no limit. The summary reports the peak, and that of the resident "
+                   "set size")
+                ("huge-pages"
+                 , boost::program_options::bool_switch(&OutputArena::hugePages())
+                 , "Back the output buffers of batches, of 2 MB and more, with transparent huge pages where the "
+                   "kernel has them")
+                ("max-latency"
+                 , boost::program_options::value<int>(&trim_opts.max_latency)->default_value(0)
+                 , "Streaming mode for reads piped in as they are sequenced: input is taken as it comes, a batch is "
+                   "handed out once its first read has waited this many milliseconds for the rest, and output is "
+                   "flushed as soon as it is written; the summary reports the p50 and p99 latency of the reads. "
+                   "Plain fastq/fasta input only; 0 for batches of full size")
+                ("shard"
+                 , boost::program_options::value<std::string>(&shard)->default_value("")
+                 , "Trim only the i-th of n parts of the input, \"i/n\" counting from 1, for array jobs each taking "
+                   "a part of the same file: the part starts at the first record after byte (i - 1) * size / n and "
+                   "ends where the next starts. Plain or BGZF compressed fastq/fasta files only. "
+                   "See \"trim_isoseq_polyA merge -h\" to put the outputs of the parts together")
+                ("pin"
+                 , boost::program_options::bool_switch(&trim_opts.pin)
+                 , "Pin each worker thread to a CPU allowed to the process, those of one NUMA node before the next, "
+                   "so that the buffers a worker allocates stay on its node; the summary breaks the work down "
+                   "by node. Linux only")
                 ("generic,G"
-                 , boost::program_options::bool_switch(&generic_format)
+                 , boost::program_options::bool_switch(&trim_opts.generic_format)
                  , "Input is generic fasta format; "
                    "By default, this script adjusts the coordinate in the header section of output fasta format for "
-                   "Iso-seq input. This option switches off this behavior.");
+                   "Iso-seq input. This option switches off this behavior.")
+                ("bam"
+                 , boost::program_options::bool_switch(&trim_opts.bam_output)
+                 , "Write trimmed reads as unaligned BAM, tagged with the polyA length in pA:i; "
+                   "the header and tags of BAM input are kept")
+                ("io"
+                 , boost::program_options::value<std::string>(&io_backend)->default_value("uring")
+                 , "How the input file and stdout are read and written: "
+                   "uring (io_uring with several requests in flight; pread/pwrite if unavailable), "
+                   "sync (pread/pwrite) or stream (iostreams/stdio)")
+                ("ordered"
+                 , boost::program_options::bool_switch(&trim_opts.ordered)
+                 , "Write the output, and the log, in the order of the input so that reruns are byte-identical; "
+                   "batches finished early are held back in a bounded window")
+                ("annotate"
+                 , boost::program_options::value<std::string>(&trim_opts.annotate)->implicit_value("name")
+                 , "Only annotate the reads instead of writing them: one \"name<tab>polyA length\" per read "
+                   "to stdout, or its ordinal in the input, counting from 0, for --annotate=ordinal; "
+                   "the header is kept as it is and there is no log on stderr")
+                ("score"
+                 , boost::program_options::bool_switch(&trim_opts.score)
+                 , "Add the log2 odds of the polyA tail, polyA over non-polyA emissions, to --annotate output")
+                ("summary"
+                 , boost::program_options::value<std::string>(&trim_opts.summary_file)->default_value("")
+                 , "Write a summary of the run, one \"key<tab>value\" per line, to this file; "
+                   "writer_stalls counts the times a worker waited for the output to be written")
+                ("trimmed-out"
+                 , boost::program_options::value<std::string>(&trim_opts.output_files[TRIMMED])->default_value("")
+                 , "Write the reads with a polyA tail, trimmed, to this file instead of stdout; "
+                   "BGZF (gzip compatible) compressed if it ends with .gz")
+                ("untouched-out"
+                 , boost::program_options::value<std::string>(&trim_opts.output_files[UNTOUCHED])->default_value("")
+                 , "Write the reads without a polyA tail to this file instead of stdout, compressed as --trimmed-out")
+                ("polyA-out"
+                 , boost::program_options::value<std::string>(&trim_opts.output_files[POLYA_ONLY])->default_value("")
+                 , "Write the reads that are nothing but polyA, which are dropped otherwise, as they are "
+                   "to this file, compressed as --trimmed-out")
+                ("polyA-tails-out"
+                 , boost::program_options::value<std::string>(&trim_opts.output_files[POLYA_TAILS])->default_value("")
+                 , "Write the polyA tails of the reads as fasta to this file, for training with -a, and the rest of "
+                   "the same reads to --non-polyA-out, for -b; only tails of at least 10 nt and 75% A are taken. "
+                   "Compressed as --trimmed-out")
+                ("non-polyA-out"
+                 , boost::program_options::value<std::string>(&trim_opts.output_files[NON_POLYA])->default_value("")
+                 , "See --polyA-tails-out")
+                ("results"
+                 , boost::program_options::value<std::string>(&trim_opts.results_file)->default_value("")
+                 , "Write the per-read results to this file instead of logging the polyA length to stderr, "
+                   "which is then left for diagnostics; one \"name<tab>length<tab>polyA length<tab>flags\" "
+                   "per read under a header line, flags being 1 for a polyA tail and 2 for nothing but polyA")
+                ("results-binary"
+                 , boost::program_options::bool_switch(&trim_opts.results_binary)
+                 , "Write --results in a compact binary layout, see results.hpp");
         boost::program_options::variables_map vm;
         boost::program_options::store(boost::program_options::parse_command_line(argc, argv, opts), vm);
         boost::program_options::notify(vm);
@@ -214,6 +1062,89 @@ int main(int argc, const char *argv[]) {
         std::cerr << opts << std::endl;
         exit(EXIT_FAILURE);
     }
+#ifndef TO_SUPPORT_BAM
+    if (trim_opts.bam_output) {
+        fprintf(stderr, "Error: --bam is not supported in this build, rebuild with -DSUPPORT_BAM=ON\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+    if (io_backend == "uring") {
+        trim_opts.io = IoBackendKind::URING;
+    } else if (io_backend == "sync") {
+        trim_opts.io = IoBackendKind::SYNC;
+    } else if (io_backend == "stream") {
+        trim_opts.io = IoBackendKind::STREAM;
+    } else {
+        fprintf(stderr, "Error: unknown io backend %s\n", io_backend.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (trim_opts.num_thread <= 0)
+        trim_opts.num_thread = availableCpus();
+    if (!parseSize(max_memory, trim_opts.max_memory)) {
+        fprintf(stderr, "Error: cannot understand --max-memory %s, expecting e.g. 500M or 2G\n", max_memory.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (trim_opts.max_latency > 0)
+        trim_opts.lookahead = 0; /* blocks are handed out as they are read */
+    trim_opts.shard_index = trim_opts.shard_count = 0;
+    if (!shard.empty()) {
+        if (!parseShard(shard, trim_opts.shard_index, trim_opts.shard_count)) {
+            fprintf(stderr, "Error: cannot understand --shard %s, expecting i/n with 1 <= i <= n\n", shard.c_str());
+            exit(EXIT_FAILURE);
+        }
+        if (trim_opts.max_latency > 0) {
+            fprintf(stderr, "Error: cannot specify --shard with --max-latency\n");
+            exit(EXIT_FAILURE);
+        }
+        if (trim_opts.annotate == "ordinal") {
+            fprintf(stderr, "Error: cannot specify --annotate=ordinal with --shard, the ordinals would count from the "
+                            "start of each part\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (trim_opts.compress_threads < 0) {
+        fprintf(stderr, "Error: --compress-threads cannot be negative\n");
+        exit(EXIT_FAILURE);
+    }
+    if (trim_opts.bam_output && trim_opts.show_color) {
+        fprintf(stderr, "Error: cannot specify -c with --bam\n");
+        exit(EXIT_FAILURE);
+    }
+    if (!trim_opts.annotate.empty()) {
+        if (trim_opts.annotate != "name" && trim_opts.annotate != "ordinal") {
+            fprintf(stderr, "Error: unknown --annotate %s, expecting name or ordinal\n", trim_opts.annotate.c_str());
+            exit(EXIT_FAILURE);
+        }
+        if (trim_opts.bam_output || trim_opts.show_color) {
+            fprintf(stderr, "Error: cannot specify -c or --bam with --annotate\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (trim_opts.score && trim_opts.annotate.empty()) {
+        fprintf(stderr, "Error: --score goes with --annotate\n");
+        exit(EXIT_FAILURE);
+    }
+    if (trim_opts.output_files[POLYA_TAILS].empty() != trim_opts.output_files[NON_POLYA].empty()) {
+        fprintf(stderr, "Error: need to specify both --polyA-tails-out and --non-polyA-out\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < k_num_output_files; ++c) {
+        const std::string& file = trim_opts.output_files[c];
+        if (file.empty())
+            continue;
+        if (c < k_num_read_classes && (trim_opts.bam_output || trim_opts.show_color || !trim_opts.annotate.empty())) {
+            fprintf(stderr, "Error: cannot specify -c, --bam or --annotate with --trimmed-out, --untouched-out "
+                            "or --polyA-out\n");
+            exit(EXIT_FAILURE);
+        }
+#ifndef TO_SUPPORT_BAM
+        if (isGzFileName(file)) {
+            fprintf(stderr, "Error: cannot compress %s in this build, rebuild with -DSUPPORT_BAM=ON\n", file.c_str());
+            exit(EXIT_FAILURE);
+        }
+#endif
+        k_output_files[c].reset(new OutputFile{file, trim_opts.io, isGzFileName(file)});
+    }
     PolyAHmmMode hmm;
     // initializing HMM model
     if (!train_polya_file.empty() && !train_nonpolya_file.empty()) {
@@ -240,31 +1171,347 @@ int main(int argc, const char *argv[]) {
         setDefaultHMM(hmm);
     }
 
+    if (!trim_opts.results_file.empty()) {
+        if (!trim_opts.annotate.empty()) {
+            fprintf(stderr, "Error: cannot specify --results with --annotate\n");
+            exit(EXIT_FAILURE);
+        }
+        k_results_file.reset(new OutputFile{trim_opts.results_file, trim_opts.io, false});
+        if (trim_opts.results_binary)
+            k_results_file->sink().write(k_results_magic, k_results_magic_size);
+        else
+            k_results_file->sink().write(k_results_header, sizeof(k_results_header) - 1);
+    } else if (trim_opts.results_binary) {
+        fprintf(stderr, "Error: --results-binary goes with --results\n");
+        exit(EXIT_FAILURE);
+    }
+
     // trim
-    FastqReader<> reader(input_fq_file);
-    auto iter = reader.begin();
-    auto end = reader.end();
-    MultiThreadSafeQueue<fastq_t, std::vector> producer(iter, end, default_bulk_size);
+    if (trim_opts.io != IoBackendKind::STREAM) {
+        fflush(stdout);
+        k_stdout_sink.reset(new AsyncFileSink{STDOUT_FILENO, trim_opts.io});
+    }
+    int ret;
+    if (trim_opts.max_latency > 0) {
+        FormatBlockReader reader(input_fq_file, std::chrono::milliseconds(trim_opts.max_latency));
+        ret = trimInput(hmm, reader, trim_opts, input_fq_file);
+    } else if (trim_opts.shard_count) {
+        ret = trimShard(hmm, trim_opts, input_fq_file);
+    } else
+#ifdef TO_SUPPORT_BAM
+    if (isBgzfFile(input_fq_file)) {
+        BgzfBlockReader reader(input_fq_file, trim_opts.io);
+        ret = trimInput(hmm, reader, trim_opts, input_fq_file);
+    } else
+#endif
+    {
+        FormatBlockReader reader(input_fq_file, trim_opts.io);
+        ret = trimInput(hmm, reader, trim_opts, input_fq_file);
+    }
+    k_stdout_sink.reset(); /* flush */
+    for (auto& file : k_output_files)
+        file.reset();
+    k_results_file.reset();
+    if (!trim_opts.summary_file.empty())
+        writeSummary(trim_opts.summary_file);
+    return ret;
+}
+
+void writeSummary(const std::string& file) {
+    FILE *f = fopen(file.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "Error: cannot write summary to %s\n", file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "reads\t%llu\n", (unsigned long long) k_summary.reads);
+    fprintf(f, "reads_trimmed\t%llu\n", (unsigned long long) k_summary.reads_trimmed);
+    fprintf(f, "reads_polyA_only\t%llu\n", (unsigned long long) k_summary.reads_polyA_only);
+    fprintf(f, "batch_bases\t%llu\n", (unsigned long long) k_summary.batch_bases);
+    fprintf(f, "input_empty_waits\t%llu\n", (unsigned long long) k_summary.input.empty_waits);
+    fprintf(f, "input_full_waits\t%llu\n", (unsigned long long) k_summary.input.full_waits);
+    fprintf(f, "writer_stalls\t%llu\n", (unsigned long long) k_summary.writer_stalls);
+    fprintf(f, "writer_stall_seconds\t%.6f\n", k_summary.writer_stall_us / 1e6);
+    fprintf(f, "reorder_peak_batches\t%llu\n", (unsigned long long) k_summary.reorder_peak);
+    double worker_seconds = 0;
+    for (const auto& w : k_summary.workers)
+        worker_seconds += w.busy_seconds;
+    fprintf(f, "threads\t%zu\n", k_summary.workers.size());
+    fprintf(f, "reader_seconds\t%.6f\n", k_summary.input.read_seconds);
+    fprintf(f, "worker_seconds\t%.6f\n", worker_seconds);
+    fprintf(f, "writer_seconds\t%.6f\n", k_summary.writer_seconds);
+#ifdef TO_COUNT_ALLOCATIONS
+    uint64_t allocations = 0;
+    for (const auto& w : k_summary.workers)
+        allocations += w.allocations;
+    fprintf(f, "worker_allocations\t%llu\n", (unsigned long long) allocations);
+#endif
+    if (k_summary.latency.reads()) {
+        fprintf(f, "latency_p50_ms\t%.3f\n", k_summary.latency.quantile(0.5));
+        fprintf(f, "latency_p99_ms\t%.3f\n", k_summary.latency.quantile(0.99));
+        fprintf(f, "latency_max_ms\t%.3f\n", k_summary.latency.max());
+    }
+    fprintf(f, "memory_waits\t%llu\n", (unsigned long long) k_summary.memory_waits);
+    fprintf(f, "memory_peak_bytes\t%llu\n", (unsigned long long) k_summary.memory_peak);
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) /* ru_maxrss is in kilobytes on Linux */
+        fprintf(f, "peak_rss_bytes\t%llu\n", (unsigned long long) usage.ru_maxrss * 1024);
+    std::map<int, WorkerSummary> nodes; /* of the pinned workers, summed by node */
+    std::map<int, int> node_workers;
+    for (const auto& w : k_summary.workers) {
+        if (w.cpu < 0)
+            continue;
+        WorkerSummary& node = nodes[w.node];
+        node.reads += w.reads;
+        node.bases += w.bases;
+        node.busy_seconds += w.busy_seconds;
+        ++node_workers[w.node];
+    }
+    for (const auto& node : nodes) {
+        const WorkerSummary& w = node.second;
+        fprintf(f, "node%d_workers\t%d\n", node.first, node_workers[node.first]);
+        fprintf(f, "node%d_reads\t%llu\n", node.first, (unsigned long long) w.reads);
+        fprintf(f, "node%d_bases\t%llu\n", node.first, (unsigned long long) w.bases);
+        fprintf(f, "node%d_busy_seconds\t%.6f\n", node.first, w.busy_seconds);
+        fprintf(f, "node%d_bases_per_second\t%.0f\n", node.first,
+                w.busy_seconds > 0 ? w.bases / w.busy_seconds * node_workers[node.first] : 0.0);
+    }
+    fclose(f);
+}
+
+#ifdef TO_SUPPORT_BAM
+/* BAM is always BGZF compressed */
+bool trimBam(const PolyAHmmMode&, FormatBlockReader&, const TrimOptions&) {
+    return false;
+}
+
+bool trimBam(const PolyAHmmMode& hmm, BgzfBlockReader& reader, const TrimOptions& opts) {
+    std::string header;
+    if (!readBamHeader(reader, header))
+        return false;
+    trim<bam_t>(hmm, reader, opts, header);
+    return true;
+}
+#endif
+
+template <class Reader>
+int trimInput(const PolyAHmmMode& hmm, Reader& reader, const TrimOptions& opts, const std::string& input_file) {
+    switch (reader.peek()) { /* detect input format by its first character */
+        case '@':
+            trim<fastq_t>(hmm, reader, opts);
+            return EXIT_SUCCESS;
+        case '>':
+            trim<fasta_t>(hmm, reader, opts);
+            return EXIT_SUCCESS;
+#ifdef TO_SUPPORT_BAM
+        case 'B':
+            if (trimBam(hmm, reader, opts))
+                return EXIT_SUCCESS;
+            break;
+#endif
+        case EOF:
+            return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "Error: unrecognized format of %s, expecting fastq, fasta or BAM\n", input_file.c_str());
+    return EXIT_FAILURE;
+}
+
+/* the part of input_file of shard opts.shard_index, of records T */
+template <class T>
+ShardRange shardOf(bool bgzf, const TrimOptions& opts, const std::string& input_file) {
+#ifdef TO_SUPPORT_BAM
+    if (bgzf)
+        return bgzfShard<T>(input_file, opts.shard_index, opts.shard_count);
+#endif
+    (void) bgzf;
+    return plainShard<T>(input_file, opts.shard_index, opts.shard_count);
+}
+
+/* as above, by the format of the records, whose first character is first */
+ShardRange shardOf(int first, bool bgzf, const TrimOptions& opts, const std::string& input_file) {
+    switch (first) {
+        case '@':
+            return shardOf<fastq_t>(bgzf, opts, input_file);
+        case '>':
+            return shardOf<fasta_t>(bgzf, opts, input_file);
+    }
+    fprintf(stderr, "Error: cannot shard %s, only plain or BGZF compressed fastq and fasta can be\n",
+            input_file.c_str());
+    exit(EXIT_FAILURE);
+}
+
+int trimShard(const PolyAHmmMode& hmm, const TrimOptions& opts, const std::string& input_file) {
+    if (input_file == "stdin" || input_file == "-") {
+        fprintf(stderr, "Error: --shard needs a regular input file, cannot shard stdin\n");
+        exit(EXIT_FAILURE);
+    }
+#ifdef TO_SUPPORT_BAM
+    if (isBgzfFile(input_file)) {
+        BgzfBlockReader reader(input_file, opts.io, shardOf(BgzfBlockReader(input_file).peek(), true, opts, input_file));
+        return trimInput(hmm, reader, opts, input_file);
+    }
+#endif
+    int first = std::ifstream(input_file, std::ios::binary).get();
+    FormatBlockReader reader(input_file, opts.io, shardOf(first, false, opts, input_file));
+    return trimInput(hmm, reader, opts, input_file);
+}
+
+int mergeMain(int argc, const char *argv[]) {
+    boost::program_options::options_description
+        opts(R"(this program merges the outputs of the shards of a run (see --shard), given in the order of the shards
+usage: trim_isoseq_polyA merge [-o merged] SHARD_OUTPUT...
+       trim_isoseq_polyA merge --summary merged.tsv SHARD_SUMMARY...)");
+    std::string output_file;
+    std::string summary_file;
+    std::vector<std::string> inputs;
+    try {
+        opts.add_options()
+                ("help,h", "display this help message and exit")
+                ("output,o"
+                 , boost::program_options::value<std::string>(&output_file)->default_value("")
+                 , "File to write the merged output to instead of stdout; the outputs are concatenated as they are, "
+                   "BGZF compressed ones block by block, keeping a single BAM header and end-of-file marker")
+                ("summary"
+                 , boost::program_options::value<std::string>(&summary_file)->default_value("")
+                 , "Sum the --summary files of the shards instead into this file; peaks, latencies and batch_bases "
+                   "are the largest of the shards")
+                ("inputs"
+                 , boost::program_options::value<std::vector<std::string> >(&inputs)->required()
+                 , "Outputs of the shards, or their summaries, in order");
+        boost::program_options::positional_options_description positional;
+        positional.add("inputs", -1);
+        boost::program_options::variables_map vm;
+        boost::program_options::store(boost::program_options::command_line_parser(argc, argv)
+                                          .options(opts).positional(positional).run(), vm);
+        if (vm.count("help")) {
+            std::cerr << opts << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        boost::program_options::notify(vm);
+    }
+    catch (std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << opts << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const std::string& file = summary_file.empty() ? output_file : summary_file;
+    FILE *out = file.empty() ? stdout : fopen(file.c_str(), "wb");
+    if (!out) {
+        fprintf(stderr, "Error: cannot write to %s\n", file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    if (summary_file.empty())
+        mergeOutputs(inputs, out);
+    else
+        mergeSummaries(inputs, out);
+    if (fflush(out) != 0 || (out != stdout && fclose(out) != 0)) {
+        fprintf(stderr, "Error: failed to write to %s\n", file.empty() ? "stdout" : file.c_str());
+        exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* a worker which waits to be started before it runs, so that the thread it runs on is pinned before the worker
+ * allocates anything */
+template <class W>
+struct Gated {
+    W worker;
+    std::shared_future<void> start;
+
+    void operator()() {
+        start.wait();
+        worker();
+    }
+};
+
+/* run workers of type W on the records of reader and the writer thread draining their output */
+template <class W, class Reader>
+void runWorkers(const PolyAHmmMode& hmm, Reader& reader, const TrimOptions& opts) {
+    BatchSizer sizer(opts.batch_bases ? opts.batch_bases : k_default_batch_bases, !opts.batch_bases);
+    MemoryBudget budget(opts.max_memory);
+    typename W::producer_type producer(reader, k_max_batch_records, W::fields, &sizer, opts.lookahead, &budget);
+    const int n = opts.num_thread;
+    typename W::writer_type writer(n, opts.ordered, opts.lookahead, budget, opts.max_latency > 0);
+    StagePool compressor(opts.compress_threads);
+    std::thread writer_thread(std::ref(writer));
     std::vector<std::thread> threads;
-    if (show_color) {
-        if (generic_format) /* generic fasta */
-            for (int i = 0; i < num_thread; ++i)
-                threads.emplace_back(Worker<decltype(producer), true, false>(hmm, producer));
+    k_summary.workers.assign(n, WorkerSummary());
+    std::vector<int> nodes, cpus;
+    if (opts.pin) {
+        nodes = cpuNodes();
+        cpus = pinningOrder(allowedCpus(), nodes);
+    }
+    std::promise<void> start;
+    std::shared_future<void> started = start.get_future().share();
+    for (int i = 0; i < n; ++i) {
+        threads.emplace_back(Gated<W>{W(hmm, producer, writer, sizer, compressor, budget, i, opts), started});
+        if (opts.pin) { /* before it is started, so that its buffers are allocated on the node of its cpu */
+            int cpu = cpus[i % cpus.size()];
+            if (pinThread(threads.back(), cpu)) {
+                k_summary.workers[i].cpu = cpu;
+                k_summary.workers[i].node = nodeOf(nodes, cpu);
+            } else {
+                fprintf(stderr, "Warning: cannot pin thread %d to cpu %d\n", i, cpu);
+            }
+        }
+    }
+    start.set_value();
+    for (auto& t : threads)
+        t.join();
+    writer.finish();
+    writer_thread.join();
+    k_summary.input = producer.stats();
+    k_summary.batch_bases = sizer.bases();
+    k_summary.memory_waits = budget.waits();
+    k_summary.memory_peak = budget.peak();
+}
+
+/* queue of the input blocks of records of type T; plain and gzip input are read ahead by a thread,
+ * BGZF input is inflated by the workers in parallel */
+template <class T, class Reader>
+struct producer_of {
+    using type = ReadAheadBlockQueue<T, std::vector, Reader>;
+};
+
+#ifdef TO_SUPPORT_BAM
+template <class T>
+struct producer_of<T, BgzfBlockReader> {
+    using type = MultiThreadSafeBlockQueue<T, std::vector, BgzfBlockReader>;
+};
+#endif
+
+template <class T, class Reader>
+void trim(const PolyAHmmMode& hmm, Reader& reader, const TrimOptions& opts, const std::string& bam_header) {
+    using producer_type = typename producer_of<T, Reader>::type;
+    if (!opts.annotate.empty()) {
+        runWorkers<Worker<producer_type, OutputMode::ANNOTATE, false> >(hmm, reader, opts);
+    } else if (opts.show_color) {
+        if (opts.generic_format) /* generic fasta */
+            runWorkers<Worker<producer_type, OutputMode::COLOR, false> >(hmm, reader, opts);
         else /* Iso-Seq FLNC specific fasta, need to adjust some coordinates in the header */
-            for (int i = 0; i < num_thread; ++i)
-                threads.emplace_back(Worker<decltype(producer), true, true>(hmm, producer));
-    } else { // don't show color
-        if (generic_format) /* generic fasta */
-            for (int i = 0; i < num_thread; ++i)
-                threads.emplace_back(Worker<decltype(producer), false, false>(hmm, producer));
+            runWorkers<Worker<producer_type, OutputMode::COLOR, true> >(hmm, reader, opts);
+    }
+#ifdef TO_SUPPORT_BAM
+    else if (opts.bam_output) {
+        OutputArena compressed;
+        const std::string header = bam_header.empty() ? unalignedBamHeader() : bam_header;
+        compressBgzf(header.data(), header.size(), compressed); /* header starts a new block as required */
+        writeStdout(compressed.data(), compressed.size());
+        if (opts.generic_format)
+            runWorkers<Worker<producer_type, OutputMode::BAM, false> >(hmm, reader, opts);
+        else
+            runWorkers<Worker<producer_type, OutputMode::BAM, true> >(hmm, reader, opts);
+    }
+#endif
+    else { // don't show color
+        if (opts.generic_format) /* generic fasta */
+            runWorkers<Worker<producer_type, OutputMode::TRIM, false> >(hmm, reader, opts);
         else /* Iso-Seq FLNC specific fasta, need to adjust some coordinates in the header */
-            for (int i = 0; i < num_thread; ++i)
-                threads.emplace_back(Worker<decltype(producer), false, true>(hmm, producer));
+            runWorkers<Worker<producer_type, OutputMode::TRIM, true> >(hmm, reader, opts);
     }
-    for (auto& t : threads)
-        if (t.joinable())
-            t.join();
-    return EXIT_SUCCESS;
+#ifdef TO_SUPPORT_BAM
+    if (opts.bam_output)
+        writeStdout(k_bgzf_eof, k_bgzf_eof_size);
+#endif
 }
 
 void setDefaultHMM(PolyAHmmMode& hmm) {
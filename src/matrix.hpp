@@ -60,8 +60,10 @@ public:
     explicit Matrix(size_t r = 0, size_t c = 0)
         : row_(r), col_(c), data_(nullptr)
     {
-        if (r > 0 && c > 0)
+        if (r > 0 && c > 0) {
             data_ = (pointer) malloc(sizeof(value_type) * row_ * col_);
+            capacity_ = row_ * col_;
+        }
     }
 
     virtual ~Matrix()
@@ -76,12 +78,14 @@ public:
         }
         data_ = (pointer) malloc(sizeof(value_type) * row_ * col_);
         memcpy(data_, other.data_, sizeof(value_type) * row_ * col_);
+        capacity_ = row_ * col_;
     }
 
     Matrix(Matrix &&other)
         : row_(other.row_), col_(other.col_)
     {
         std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
     }
 
     Matrix &operator=(const Matrix &) = delete;
@@ -91,6 +95,7 @@ public:
             row_ = other.row_;
             col_ = other.col_;
             std::swap(data_, other.data_);
+            std::swap(capacity_, other.capacity_);
         }
         return *this;
     }
@@ -138,10 +143,13 @@ public:
         return data_[j];
     }
 
+    // the memory is only reallocated to grow, so that a matrix resized for each input is allocated once
     void reSize(size_t r, size_t c)
     {
         row_ = r;
         col_ = c;
+        if (row_ * col_ <= capacity_ && data_ != nullptr)
+            return;
         if (data_ == nullptr)
             data_ = (pointer) malloc(row_ * col_ * sizeof(value_type));
         else {
@@ -149,8 +157,13 @@ public:
             assert(t != nullptr);
             data_ = (pointer) t;
         }
+        capacity_ = row_ * col_;
     }
 
+    // # of elements allocated, at least size()
+    size_t capacity() const
+    { return capacity_; }
+
     template<class TFunc, class... TArgs>
     Matrix &apply(TFunc &&func, TArgs &&... args)
     {
@@ -293,6 +306,7 @@ protected:
     size_t row_;
     size_t col_;
     pointer data_ = nullptr;
+    size_t capacity_ = 0;
 };
 
 template<class T, class U>
@@ -50,7 +50,7 @@ PolyAHmmMode::PolyAHmmMode(const PolyAHmmMode &other)
 PolyAHmmMode::PolyAHmmMode(PolyAHmmMode &&other)
     : _base(std::move(other)), forw_(std::move(other.forw_)), back_(std::move(other.back_)), post_(std::move(other
                                                                                                                  .post_)), path_(
-    std::move(other.path_))
+    std::move(other.path_)), vite_(std::move(other.vite_))
 { }
 
 PolyAHmmMode &PolyAHmmMode::operator=(PolyAHmmMode &&other)
@@ -61,6 +61,7 @@ PolyAHmmMode &PolyAHmmMode::operator=(PolyAHmmMode &&other)
         back_ = std::move(other.back_);
         post_ = std::move(other.post_);
         path_ = std::move(other.path_);
+        vite_ = std::move(other.vite_);
     }
     return *this;
 }
@@ -112,6 +112,10 @@ public:
     template<class TIter>
     const path_type &calculateVirtabi(TIter, size_t) const;
 
+    // bytes kept by calculateVirtabi for the next sequence
+    size_t virtabiCapacity() const
+    { return vite_.capacity() * sizeof(double) + path_.capacity() * sizeof(int); }
+
 /* training algorithms */
 public:
     // estimate init_, emit_ & tran_ by taking a bunch of sequences
@@ -130,6 +134,7 @@ protected:
     mutable matrix_type back_;
     mutable matrix_type post_;
     mutable path_type path_;
+    mutable matrix_type vite_; // workspace of calculateVirtabi, kept for the next sequence
 };
 
 // -----------------------------------------------
@@ -140,7 +145,12 @@ protected:
 template<class TIterator>
 auto PolyAHmmMode::calculateVirtabi(TIterator striter, size_t N) const -> const path_type &
 {
-    matrix_type prob(no_states_, N);
+    if (N == 0) { // an empty sequence has an empty path
+        path_.reSize(1, 0);
+        return path_;
+    }
+    matrix_type &prob = vite_;
+    prob.reSize(no_states_, N);
     prob = 0.0;
     double curmax, tmp;
     for (size_t i = 0; i < no_states_; ++i) {
@@ -0,0 +1,122 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+
+#ifndef results_hpp
+#define results_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include "arena.hpp"
+
+/* per-read results of trimming, see --results, in a fixed schema: name, original length, polyA length and
+ * flags. The text layout is tab separated under k_results_header; the binary one starts with
+ * k_results_magic, followed by one record per read of
+ *   uint32 name length, uint32 length, uint32 polyA length, uint8 flags, name
+ * with the integers in little endian
+ * */
+enum ResultFlags : uint8_t
+{
+    k_result_trimmed = 1u, /* has a polyA tail */
+    k_result_polyA_only = 2u /* nothing but polyA */
+};
+
+constexpr char k_results_header[] = "name\tlength\tpolyA_length\tflags\n";
+constexpr char k_results_magic[] = "PAR\1";
+constexpr size_t k_results_magic_size = sizeof(k_results_magic) - 1;
+constexpr size_t k_result_fixed_size = 13; /* of a binary record, but the name */
+
+struct ReadResult
+{
+    std::string name;
+    uint32_t length;
+    uint32_t polyA_length;
+    uint8_t flags;
+};
+
+inline uint8_t resultFlags(size_t length, size_t polyalen)
+{
+    return polyalen ? k_result_trimmed | (polyalen == length ? k_result_polyA_only : 0) : 0;
+}
+
+inline void appendLittleEndian32(OutputArena &out, uint32_t v)
+{
+    char b[4] = {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+    out.append(b, 4);
+}
+
+inline uint32_t readLittleEndian32(const unsigned char *b)
+{
+    return b[0] | uint32_t(b[1]) << 8 | uint32_t(b[2]) << 16 | uint32_t(b[3]) << 24;
+}
+
+/* append the result of the read called name to out */
+template <class S>
+inline void appendResult(OutputArena &out, const S &name, size_t length, size_t polyalen, bool binary)
+{
+    const uint8_t flags = resultFlags(length, polyalen);
+    if (binary) {
+        appendLittleEndian32(out, name.size());
+        appendLittleEndian32(out, length);
+        appendLittleEndian32(out, polyalen);
+        out.append(char(flags));
+        out.append(name.data(), name.size());
+        return;
+    }
+    out.append(name);
+    out.append('\t');
+    out.appendNumber(length);
+    out.append('\t');
+    out.appendNumber(polyalen);
+    out.append('\t');
+    out.appendNumber(flags);
+    out.append('\n');
+}
+
+/* read the next result of binary results after k_results_magic from f; false at the end */
+inline bool readResult(FILE *f, ReadResult &result)
+{
+    unsigned char b[k_result_fixed_size];
+    if (fread(b, 1, sizeof(b), f) != sizeof(b))
+        return false;
+    result.name.resize(readLittleEndian32(b));
+    result.length = readLittleEndian32(b + 4);
+    result.polyA_length = readLittleEndian32(b + 8);
+    result.flags = b[12];
+    return fread(&result.name[0], 1, result.name.size(), f) == result.name.size();
+}
+
+#endif /* results_hpp */
@@ -0,0 +1,417 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+
+
+#ifndef shard_hpp
+#define shard_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include "format.hpp"
+#include "results.hpp"
+#ifdef TO_SUPPORT_BAM
+#include "bam.hpp"
+#endif
+
+/* shards split the input by its bytes, for array jobs each reading one part of the same file: shard i of n starts
+ * at the first record right after a line break at or after byte i * size / n, and ends where shard i + 1 starts,
+ * so that each record is read by exactly one of them; plain files are resynced to records right there, BGZF
+ * files to the first block at or after the byte and then to a record in the data inflated from it */
+
+/* data of the input read to resync in windows of this many bytes, doubled until a record is found */
+constexpr size_t k_shard_sync_window = 1 << 20;
+
+/* "i/n" of --shard into index, from 0, and count; false if spec is not one with 1 <= i <= n */
+inline bool parseShard(const std::string &spec, int &index, int &count)
+{
+    char *end;
+    long i = strtol(spec.c_str(), &end, 10);
+    if (end == spec.c_str() || *end != '/') return false;
+    const char *p = end + 1;
+    long n = strtol(p, &end, 10);
+    if (end == p || *end || i < 1 || i > n || n > std::numeric_limits<int>::max()) return false;
+    index = static_cast<int>(i - 1);
+    count = static_cast<int>(n);
+    return true;
+}
+
+/* read n bytes at offset of fd into buf, exits on errors; false if the file ends short of them */
+inline bool preadFully(int fd, char *buf, size_t n, off_t offset)
+{
+    while (n) {
+        ssize_t got = pread(fd, buf, n, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            fprintf(stderr, "Error: failed to read input: %s\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (got == 0) return false;
+        buf += got;
+        n -= got;
+        offset += got;
+    }
+    return true;
+}
+
+/* open the regular file file_name to shard it, setting size; exits if it is not one, as stdin */
+inline int openShardInput(const std::string &file_name, off_t &size)
+{
+    int fd = file_name == "stdin" || file_name == "-" ? -1 : open(file_name.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "Error: --shard needs a regular input file, cannot shard %s\n", file_name.c_str());
+        exit(EXIT_FAILURE);
+    }
+    size = st.st_size;
+    return fd;
+}
+
+/* byte of shard index of count to resync from */
+inline off_t shardOffset(off_t size, int index, int count)
+{
+    return static_cast<off_t>(static_cast<unsigned __int128>(size) * index / count);
+}
+
+/* the first record of format T right after a line break at or after byte at of the plain file fd, size if none */
+template<class T>
+off_t syncPlain(int fd, off_t at, off_t size)
+{
+    if (at == 0 || at >= size) return at;
+    std::vector<char> buf;
+    for (size_t window = k_shard_sync_window;; window *= 2) {
+        size_t n = static_cast<size_t>(std::min<off_t>(window, size - at));
+        buf.resize(n);
+        preadFully(fd, buf.data(), n, at);
+        const char *r = read_policy<T>::sync(buf.data(), buf.data() + n, at + static_cast<off_t>(n) == size);
+        if (r) return at + (r - buf.data());
+    }
+}
+
+/* the bytes of shard index of count of the plain file file_name of records T */
+template<class T>
+ShardRange plainShard(const std::string &file_name, int index, int count)
+{
+    off_t size;
+    int fd = openShardInput(file_name, size);
+    ShardRange range;
+    range.begin = syncPlain<T>(fd, shardOffset(size, index, count), size);
+    range.end = syncPlain<T>(fd, shardOffset(size, index + 1, count), size);
+    close(fd);
+    return range;
+}
+
+#ifdef TO_SUPPORT_BAM
+/* the first BGZF block at or after byte at of fd, size if none; data that looks like a header is told from one
+ * by another header, or the end of the file, right after the block */
+inline off_t syncBgzfBlock(int fd, off_t at, off_t size)
+{
+    if (at == 0) return 0;
+    std::vector<char> buf(k_bgzf_max_block_size + k_bgzf_header_size);
+    char h[k_bgzf_header_size];
+    for (off_t base = at; base < size; base += k_bgzf_max_block_size) {
+        size_t n = static_cast<size_t>(std::min<off_t>(buf.size(), size - base));
+        preadFully(fd, buf.data(), n, base);
+        for (size_t i = 0; i < k_bgzf_max_block_size && i + k_bgzf_header_size <= n; ++i) {
+            if (!isBgzfHeader(&buf[i])) continue;
+            off_t next = base + i + bgzfBlockSize(&buf[i]);
+            if (next == size || (next < size && preadFully(fd, h, k_bgzf_header_size, next) && isBgzfHeader(h))) {
+                return base + i;
+            }
+        }
+    }
+    return size;
+}
+
+/* where a shard of a BGZF file starts or ends: its first record is offset bytes into the data inflated from the
+ * block at block, which ends at block_end and inflates to inflated bytes */
+struct BgzfSync
+{
+    off_t block;
+    off_t block_end;
+    size_t offset;
+    size_t inflated;
+};
+
+/* the first record of format T right after a line break in the data inflated from the first BGZF block at or after
+ * byte at of fd, at the end of the file if none */
+template<class T>
+BgzfSync syncBgzf(int fd, off_t at, off_t size)
+{
+    const off_t first = syncBgzfBlock(fd, at, size);
+    if (first == 0 || first == size) return BgzfSync{first, first, 0, 0};
+    std::string compressed, data;
+    std::vector<BgzfSync> blocks; /* read so far, offset being where their data starts in data */
+    char h[k_bgzf_header_size];
+    for (off_t block = first; block < size;) {
+        if (!preadFully(fd, h, k_bgzf_header_size, block) || !isBgzfHeader(h)) {
+            fprintf(stderr, "Error: invalid BGZF block header in the input\n");
+            exit(EXIT_FAILURE);
+        }
+        compressed.resize(bgzfBlockSize(h));
+        if (!preadFully(fd, &compressed[0], compressed.size(), block)) {
+            fprintf(stderr, "Error: truncated BGZF block in the input\n");
+            exit(EXIT_FAILURE);
+        }
+        const size_t offset = data.size();
+        if (!inflateBgzfBlock(compressed.data(), compressed.size(), data)) {
+            fprintf(stderr, "Error: corrupted BGZF block in the input\n");
+            exit(EXIT_FAILURE);
+        }
+        blocks.push_back(BgzfSync{block, block + static_cast<off_t>(compressed.size()), offset, data.size() - offset});
+        block = blocks.back().block_end;
+        const char *r = read_policy<T>::sync(data.data(), data.data() + data.size(), block == size);
+        if (r && r != data.data() + data.size()) {
+            const size_t at_data = r - data.data();
+            for (BgzfSync &b : blocks) {
+                if (at_data < b.offset + b.inflated) {
+                    b.offset = at_data - b.offset;
+                    return b;
+                }
+            }
+        }
+        if (r) break;
+    }
+    return BgzfSync{size, size, 0, 0};
+}
+
+/* the blocks of shard index of count of the BGZF file file_name of records T */
+template<class T>
+ShardRange bgzfShard(const std::string &file_name, int index, int count)
+{
+    off_t size;
+    int fd = openShardInput(file_name, size);
+    BgzfSync begin = syncBgzf<T>(fd, shardOffset(size, index, count), size);
+    BgzfSync end = syncBgzf<T>(fd, shardOffset(size, index + 1, count), size);
+    close(fd);
+    ShardRange range;
+    range.begin = begin.block;
+    range.skip = begin.offset;
+    if (end.offset) { /* the last block is read for the end of the last record, the rest of it is left out */
+        range.end = end.block_end;
+        range.drop = end.inflated - end.offset;
+    } else {
+        range.end = end.block;
+    }
+    return range;
+}
+
+/* # of bytes of the BAM header at the start of h, 0 if h does not have all of it */
+inline size_t bamHeaderSize(const std::string &h)
+{
+    size_t n = 8;
+    if (h.size() < n) return 0;
+    n += bamInt32(h.data() + 4) + 4; /* text and n_ref */
+    if (h.size() < n) return 0;
+    for (int32_t n_ref = bamInt32(h.data() + n - 4); n_ref > 0; --n_ref) {
+        if (h.size() < n + 4) return 0;
+        n += bamInt32(h.data() + n) + 8; /* l_name, name and l_ref */
+        if (h.size() < n) return 0;
+    }
+    return n;
+}
+#endif
+
+/* write all of n bytes at b to out, exits on errors */
+inline void writeMerged(FILE *out, const char *b, size_t n)
+{
+    if (fwrite(b, 1, n, out) != n) {
+        fprintf(stderr, "Error: failed to write the merged output: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* concatenate the outputs of shards, in their order, to out, without parsing their records; BGZF ones block by
+ * block, leaving out the end-of-file markers but one at the end, and the BAM header of all but the first, as
+ * the header of --results */
+inline void mergeOutputs(const std::vector<std::string> &inputs, FILE *out)
+{
+    std::vector<char> buf(1 << 20);
+#ifdef TO_SUPPORT_BAM
+    bool any_bgzf = false;
+#endif
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        FILE *in = fopen(inputs[i].c_str(), "rb");
+        if (!in) {
+            fprintf(stderr, "Error: cannot read %s\n", inputs[i].c_str());
+            exit(EXIT_FAILURE);
+        }
+        bool bgzf = false;
+#ifdef TO_SUPPORT_BAM
+        bgzf = isBgzfFile(inputs[i]);
+        any_bgzf = any_bgzf || bgzf;
+        bool skip_header = i > 0; /* of a BAM, the header of a later shard is that of the first */
+        std::string header; /* inflated from the blocks left out so far */
+        while (bgzf) {
+            size_t got = fread(buf.data(), 1, k_bgzf_header_size, in);
+            if (got == 0) break;
+            if (got < k_bgzf_header_size || !isBgzfHeader(buf.data())) {
+                fprintf(stderr, "Error: invalid BGZF block header in %s\n", inputs[i].c_str());
+                exit(EXIT_FAILURE);
+            }
+            const size_t size = bgzfBlockSize(buf.data());
+            if (fread(buf.data() + k_bgzf_header_size, 1, size - k_bgzf_header_size, in) != size - k_bgzf_header_size) {
+                fprintf(stderr, "Error: truncated BGZF block in %s\n", inputs[i].c_str());
+                exit(EXIT_FAILURE);
+            }
+            if (bamInt32(buf.data() + size - 4) == 0) continue; /* empty, e.g. the end-of-file marker */
+            if (skip_header) {
+                const bool first = header.empty();
+                if (!inflateBgzfBlock(buf.data(), size, header)) {
+                    fprintf(stderr, "Error: corrupted BGZF block in %s\n", inputs[i].c_str());
+                    exit(EXIT_FAILURE);
+                }
+                if (first && header.compare(0, 4, k_bam_magic, 4) != 0) {
+                    skip_header = false; /* not a BAM */
+                } else {
+                    const size_t n = bamHeaderSize(header);
+                    if (n && n != header.size()) {
+                        fprintf(stderr, "Error: the BAM header of %s does not end a block\n", inputs[i].c_str());
+                        exit(EXIT_FAILURE);
+                    }
+                    skip_header = !n;
+                    continue;
+                }
+            }
+            writeMerged(out, buf.data(), size);
+        }
+#endif
+        if (!bgzf && i > 0) {
+            const size_t header_size = sizeof(k_results_header) - 1;
+            size_t got = fread(buf.data(), 1, header_size, in), skip = 0;
+            if (got == header_size && memcmp(buf.data(), k_results_header, header_size) == 0)
+                skip = header_size;
+            else if (got >= k_results_magic_size && memcmp(buf.data(), k_results_magic, k_results_magic_size) == 0)
+                skip = k_results_magic_size;
+            writeMerged(out, buf.data() + skip, got - skip);
+        }
+        while (!bgzf) {
+            size_t got = fread(buf.data(), 1, buf.size(), in);
+            if (got == 0) break;
+            writeMerged(out, buf.data(), got);
+        }
+        if (ferror(in)) {
+            fprintf(stderr, "Error: failed to read %s\n", inputs[i].c_str());
+            exit(EXIT_FAILURE);
+        }
+        fclose(in);
+    }
+#ifdef TO_SUPPORT_BAM
+    if (any_bgzf) writeMerged(out, k_bgzf_eof, k_bgzf_eof_size);
+#endif
+}
+
+/* how the values of a summary key of the shards make that of the whole run */
+enum class SummaryMerge {
+    SUM, /* counts and times */
+    MAX, /* peaks, quantiles and the batch size the run settled on */
+    DROP /* of a shard alone, e.g. its threads and their rate */
+};
+
+inline SummaryMerge summaryMerge(const std::string &key)
+{
+    static const char *const peaks[] = {"batch_bases", "reorder_peak_batches", "memory_peak_bytes", "peak_rss_bytes",
+                                        "latency_p50_ms", "latency_p99_ms", "latency_max_ms"};
+    for (const char *peak : peaks) {
+        if (key == peak) return SummaryMerge::MAX;
+    }
+    auto ends = [&key](const char *suffix) {
+        size_t n = strlen(suffix);
+        return key.size() >= n && key.compare(key.size() - n, n, suffix) == 0;
+    };
+    if (key == "threads" || (key.compare(0, 4, "node") == 0 && (ends("_workers") || ends("_bases_per_second")))) {
+        return SummaryMerge::DROP;
+    }
+    return SummaryMerge::SUM;
+}
+
+/* sum the --summary files of shards into out, in the order of their keys; peaks are the largest of them and the
+ * values of a shard alone are left out, see summaryMerge; values are written with as many decimals as given */
+inline void mergeSummaries(const std::vector<std::string> &inputs, FILE *out)
+{
+    struct Value
+    {
+        double x;
+        int decimals;
+    };
+    std::vector<std::string> keys;
+    std::map<std::string, Value> values;
+    for (const auto &input : inputs) {
+        std::ifstream in(input);
+        if (!in) {
+            fprintf(stderr, "Error: cannot read %s\n", input.c_str());
+            exit(EXIT_FAILURE);
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t tab = line.find('\t');
+            if (tab == std::string::npos) {
+                fprintf(stderr, "Error: not a summary line in %s: %s\n", input.c_str(), line.c_str());
+                exit(EXIT_FAILURE);
+            }
+            const std::string key = line.substr(0, tab);
+            const SummaryMerge merge = summaryMerge(key);
+            if (merge == SummaryMerge::DROP) continue;
+            const char *v = line.c_str() + tab + 1;
+            const char *dot = strchr(v, '.');
+            Value x{strtod(v, nullptr), dot ? static_cast<int>(strlen(dot + 1)) : 0};
+            auto it = values.find(key);
+            if (it == values.end()) {
+                keys.push_back(key);
+                values.emplace(key, x);
+                continue;
+            }
+            it->second.x = merge == SummaryMerge::MAX ? std::max(it->second.x, x.x) : it->second.x + x.x;
+            it->second.decimals = std::max(it->second.decimals, x.decimals);
+        }
+    }
+    for (const auto &key : keys) {
+        const Value &x = values[key];
+        fprintf(out, "%s\t%.*f\n", key.c_str(), x.decimals, x.x);
+    }
+}
+
+#endif /* shard_hpp */
@@ -39,7 +39,20 @@
 #define TRIMISOSEQPOLYA_THREAD_H
 
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <array>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
 #include "type_policy.h"
+#include "format.hpp"
 
 /* multi-threading safe queue to produce bulk of data to process
  * data type should
@@ -80,4 +93,735 @@ private:
     std::mutex mx_;
 };
 
+/* sizes batches of input by their # of bases instead of records, so that batches of short and of long reads
+ * take about as long to process; adaptive sizing aims each batch at overhead_ratio times the time it takes
+ * to hand out, between min_seconds and max_seconds not to leave stragglers at the end of the run, from the
+ * per-base cost measured by the workers; the reader gets it as bytes of input, by the measured bytes per base
+ * */
+class BatchSizer
+{
+public:
+    constexpr static double overhead_ratio = 100;
+    constexpr static double min_seconds = 0.001;
+    constexpr static double max_seconds = 0.02;
+    constexpr static size_t min_bases = 1000;
+
+    BatchSizer(size_t bases, bool adaptive)
+        : bases_(bases), adaptive_(adaptive), bytes_(bases * 2) /* as fastq until measured */
+    { }
+
+    /* bytes of input for the next batch */
+    size_t bytes() const
+    {
+        return bytes_.load(std::memory_order_relaxed);
+    }
+
+    size_t bases() const
+    {
+        std::lock_guard<std::mutex> lock(mx_);
+        return bases_;
+    }
+
+    /* a batch of bytes of input with bases in it took seconds to process, after waited seconds to get it */
+    void record(size_t bytes, size_t bases, double seconds, double waited)
+    {
+        if (!bases) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mx_);
+        average(bytes_per_base_, static_cast<double>(bytes) / bases);
+        if (adaptive_) {
+            average(seconds_per_base_, seconds / bases);
+            average(overhead_, waited);
+            double target = overhead_ * overhead_ratio;
+            target = target < min_seconds ? min_seconds : target > max_seconds ? max_seconds : target;
+            size_t bases = static_cast<size_t>(target / std::max(seconds_per_base_, 1e-12));
+            bases_ = bases < min_bases ? min_bases : bases;
+        }
+        ++samples_;
+        bytes_.store(static_cast<size_t>(bases_ * bytes_per_base_), std::memory_order_relaxed);
+    }
+
+private:
+    /* exponentially weighted, starting at the first sample */
+    void average(double &avg, double sample) const
+    {
+        avg = samples_ ? avg + (sample - avg) / 4 : sample;
+    }
+
+    mutable std::mutex mx_;
+    size_t bases_;
+    bool adaptive_;
+    double bytes_per_base_ = 2;
+    double seconds_per_base_ = 0;
+    double overhead_ = 0;
+    uint64_t samples_ = 0;
+    std::atomic<size_t> bytes_;
+};
+
+/* how often the threads on either end of a block queue had to wait for each other */
+struct QueueStats
+{
+    uint64_t empty_waits = 0; /* a worker waited for the reader */
+    uint64_t full_waits = 0; /* the reader waited for the workers */
+    double read_seconds = 0; /* the reader spent reading, and inflating gzip input, if it has a thread */
+};
+
+/* lets a thread sleep until another one has news for it, e.g. a ring is no longer empty or full;
+ * the lock is only taken by a sleeping thread and whoever wakes it, and sleeps are bounded, so
+ * a wake-up racing with going to sleep costs at most one timeout
+ * */
+class Doorbell
+{
+public:
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mx_);
+        waiting_.store(true);
+        cv_.wait_for(lock, std::chrono::milliseconds(1));
+        waiting_.store(false);
+    }
+
+    void ring()
+    {
+        if (waiting_.load()) {
+            std::lock_guard<std::mutex> lock(mx_);
+            cv_.notify_all();
+        }
+    }
+
+private:
+    std::mutex mx_;
+    std::condition_variable cv_;
+    std::atomic<bool> waiting_{false};
+};
+
+/* bytes of memory taken by the batches in flight, from the input block read to the output written, see
+ * --max-memory; whoever is about to read another block waits while the budget is spent, the rest is charged
+ * regardless, so that the batches in flight always get written and give the memory back
+ * */
+class MemoryBudget
+{
+public:
+    /* limit: in bytes, 0 for none */
+    explicit MemoryBudget(size_t limit = 0)
+        : limit_(limit)
+    { }
+
+    /* the limit is taken, by some memory waiting for batches in flight gives back; once all that is taken is
+     * kept, see keep(), it is no longer spent so that a batch at a time gets through */
+    bool spent() const
+    {
+        size_t used = used_.load();
+        return limit_ && used >= limit_ && used > kept_.load();
+    }
+
+    /* whether n more bytes can be taken without going over the limit */
+    bool fits(size_t n) const
+    {
+        return !limit_ || used_.load() + n <= limit_;
+    }
+
+    /* until the batches in flight give back enough memory */
+    void wait()
+    {
+        if (!spent()) {
+            return;
+        }
+        waits_.fetch_add(1, std::memory_order_relaxed);
+        while (spent()) {
+            room_.wait();
+        }
+    }
+
+    void charge(size_t n)
+    {
+        size_t used = used_.fetch_add(n) + n;
+        size_t peak = peak_.load();
+        while (used > peak && !peak_.compare_exchange_weak(peak, used)) { }
+    }
+
+    void release(size_t n)
+    {
+        used_.fetch_sub(n);
+        room_.ring();
+    }
+
+    /* charge memory which is not given back as batches are written, e.g. buffers kept to be reused */
+    void keep(size_t n)
+    {
+        kept_.fetch_add(n);
+        charge(n);
+    }
+
+    void unkeep(size_t n)
+    {
+        kept_.fetch_sub(n);
+        release(n);
+    }
+
+    size_t peak() const
+    {
+        return peak_.load();
+    }
+
+    uint64_t waits() const
+    {
+        return waits_.load();
+    }
+
+private:
+    size_t limit_;
+    std::atomic<size_t> used_{0};
+    std::atomic<size_t> kept_{0}; /* of used_, see keep() */
+    std::atomic<size_t> peak_{0};
+    std::atomic<uint64_t> waits_{0};
+    Doorbell room_; /* memory was given back */
+};
+
+/* # of records a thread keeps to reuse, see readRecords */
+constexpr size_t k_spare_records = 4096;
+
+/* parse the records of block into ret, reusing the records already there and the capacity of their strings,
+ * so that a batch handed back to be refilled, see the get(ret, block, pos) of the block queues, allocates next
+ * to nothing once its records have grown to the reads of the input */
+template<class T, template<class...> class Container>
+void readRecords(Container<T> &ret, const std::string &block, unsigned fields)
+{
+    using policies = linear_container_policy<Container, T>;
+    const char *p = block.data();
+    const char *e = p + block.size();
+    static thread_local std::vector<T> spare; /* records left over by smaller batches, to grow larger ones */
+    auto it = ret.begin();
+    size_t n = 0;
+    for (; p != e && it != ret.end(); ++it, ++n) {
+        read_policy<T>::read(*it, p, e, fields);
+    }
+    for (; p != e; ++n) {
+        if (spare.empty()) {
+            policies::add_to_right(ret, read_policy<T>::read(p, e, fields));
+            continue;
+        }
+        read_policy<T>::read(spare.back(), p, e, fields);
+        policies::add_to_right(ret, std::move(spare.back()));
+        spare.pop_back();
+    }
+    for (it = std::next(ret.begin(), n); it != ret.end() && spare.size() < k_spare_records; ++it) {
+        spare.emplace_back(std::move(*it));
+    }
+    policies::truncate(ret, n);
+}
+
+/* multi-threading safe queue handing out raw record-aligned blocks of the input
+ * only the boundary scan of the reader is done under its lock, records are parsed
+ * by the calling thread afterwards, so parsing of different blocks proceeds in parallel
+ * data type should
+ * 1. provide a read_policy with scan() and read(const char *&, const char *)
+ * reader type should
+ * 1. provide a thread safe "template<class T> bool next(std::string&, size_t, BlockPosition&)", e.g. FormatBlockReader, BgzfBlockReader
+ * container type should
+ * 1. has specialized linear_container_policy which provides "reserve" "add_to_right" "empty" policies
+ * */
+template<class T, template<class...> class Container = std::vector, class Reader = FormatBlockReader>
+class MultiThreadSafeBlockQueue
+{
+public:
+    using reader_type = Reader;
+    using container_type = Container<T>;
+    using policies = linear_container_policy<Container, T>;
+public:
+    /* fields: those of RecordFields to be read, see read_policy::read */
+    /* size: max # of records in a batch; sizer, if any, sizes batches by their bases below that;
+     * lookahead, see ReadAheadBlockQueue, is ignored as blocks are handed out as they are read;
+     * budget, if any, is charged the bytes of each block, to be released once its batch is done with */
+    MultiThreadSafeBlockQueue(reader_type &reader, int size, unsigned fields = k_all_fields,
+                              BatchSizer *sizer = nullptr, size_t /* lookahead */ = 0, MemoryBudget *budget = nullptr)
+        : reader_(reader), size_(size), fields_(fields), sizer_(sizer), budget_(budget)
+    { }
+
+    /* records own all their fields, as block is gone once they are returned */
+    container_type get()
+    {
+        std::string block;
+        BlockPosition pos;
+        return get(block, pos, fields_ | k_field_owned);
+    }
+
+    /* as get(), the records are read from block, which is kept to let them refer to their raw bytes */
+    container_type get(std::string &block)
+    {
+        BlockPosition pos;
+        return get(block, pos);
+    }
+
+    /* as get(block), pos is set to the position of the batch in the input */
+    container_type get(std::string &block, BlockPosition &pos)
+    {
+        return get(block, pos, fields_);
+    }
+
+    /* as get(block, pos), into ret, the records of a batch done with, see readRecords */
+    void get(container_type &ret, std::string &block, BlockPosition &pos)
+    {
+        next(block, pos);
+        readRecords(ret, block, fields_);
+    }
+
+private:
+    container_type get(std::string &block, BlockPosition &pos, unsigned fields)
+    {
+        next(block, pos);
+        container_type ret;
+        if (!sizer_) {
+            policies::reserve(ret, size_);
+        }
+        readRecords(ret, block, fields);
+        return ret;
+    }
+
+    void next(std::string &block, BlockPosition &pos)
+    {
+        if (budget_) {
+            budget_->wait();
+        }
+        reader_.template next<T>(block, size_, pos, sizer_ ? sizer_->bytes() : std::numeric_limits<size_t>::max());
+        if (budget_) {
+            budget_->charge(block.size());
+        }
+    }
+
+    reader_type &reader_;
+    int size_;
+    unsigned fields_;
+    BatchSizer *sizer_;
+    MemoryBudget *budget_;
+
+public:
+    /* workers read the blocks themselves, so they never wait on a queue */
+    QueueStats stats() const
+    {
+        return QueueStats{};
+    }
+};
+
+/* lock-free ring of N slots between exactly one producer thread and one consumer thread */
+template<class T, size_t N>
+class SpscRing
+{
+public:
+    /* producer only; v is moved from only if there is room */
+    bool push(T &v)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        slots_[tail % N] = std::move(v);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* consumer only; the slot to be popped next, nullptr if empty */
+    T *front()
+    {
+        return at(0);
+    }
+
+    /* consumer only; the slot to be popped i-th from now, nullptr if there are not that many */
+    T *at(size_t i)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (tail_.load(std::memory_order_acquire) - head <= i) {
+            return nullptr;
+        }
+        return &slots_[(head + i) % N];
+    }
+
+    /* consumer only */
+    bool pop(T &v)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        v = std::move(slots_[head % N]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, N> slots_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/* bounded lock-free ring of N slots between any number of producer and consumer threads; each slot
+ * carries a sequence number telling whose turn it is, so threads only contend on the head or tail index
+ * */
+template<class T, size_t N>
+class MpmcRing
+{
+public:
+    MpmcRing()
+    {
+        for (size_t i = 0; i < N; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /* v is moved from only if there is room */
+    bool push(T &v)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells_[pos % N];
+            intptr_t dif = intptr_t(cell.seq.load(std::memory_order_acquire)) - intptr_t(pos);
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(v);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false; /* full */
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T &v)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell &cell = cells_[pos % N];
+            intptr_t dif = intptr_t(cell.seq.load(std::memory_order_acquire)) - intptr_t(pos + 1);
+            if (dif == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    v = std::move(cell.value);
+                    cell.seq.store(pos + N, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false; /* empty */
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::array<Cell, N> cells_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+/* tasks of a stage counted so that whoever submitted them can wait for them, see StagePool */
+struct TaskGroup
+{
+    std::atomic<size_t> pending{0};
+};
+
+/* a stage of the pipeline with threads of its own, e.g. compression: tasks submitted by the stage before it
+ * are queued in a bounded lock-free ring and run by whichever thread is free. A full queue, or a stage of no
+ * threads, runs the task right away on the submitting thread, and a thread waiting for its tasks runs queued
+ * ones meanwhile, so that stages never wait on each other in a cycle
+ * */
+class StagePool
+{
+public:
+    /* # of tasks queued at most */
+    constexpr static size_t queue_size = 256;
+
+    explicit StagePool(int threads)
+    {
+        for (int i = 0; i < threads; ++i) {
+            threads_.emplace_back(&StagePool::run, this);
+        }
+    }
+
+    StagePool(const StagePool &) = delete;
+
+    StagePool &operator=(const StagePool &) = delete;
+
+    ~StagePool()
+    {
+        stop_.store(true);
+        for (auto &t : threads_) {
+            t.join();
+        }
+    }
+
+    size_t size() const
+    {
+        return threads_.size();
+    }
+
+    void submit(TaskGroup &group, std::function<void()> fn)
+    {
+        Task task{std::move(fn), &group};
+        group.pending.fetch_add(1);
+        if (threads_.empty() || !queue_.push(task)) {
+            finish(task);
+            return;
+        }
+        work_.ring();
+    }
+
+    /* run queued tasks, of any group, until those of group are done */
+    void wait(TaskGroup &group)
+    {
+        while (group.pending.load() != 0) {
+            if (!runOne()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup *group;
+    };
+
+    static void finish(Task &task)
+    {
+        task.fn();
+        task.group->pending.fetch_sub(1);
+    }
+
+    bool runOne()
+    {
+        Task task;
+        if (!queue_.pop(task)) {
+            return false;
+        }
+        finish(task);
+        return true;
+    }
+
+    void run()
+    {
+        while (!stop_.load()) {
+            if (!runOne()) {
+                work_.wait();
+            }
+        }
+    }
+
+    MpmcRing<Task, queue_size> queue_;
+    Doorbell work_; /* the queue is no longer empty */
+    std::atomic<bool> stop_{false};
+    std::vector<std::thread> threads_; /* last, to start once the rest is built */
+};
+
+/* as MultiThreadSafeBlockQueue, but the blocks are read ahead by a thread of its own into a bounded
+ * lock-free ring, so workers never wait for each other on the reader, only for the reader itself when
+ * the ring is empty; the reader sleeps while the ring is full. Suits readers whose next() is done under
+ * their lock entirely, e.g. FormatBlockReader, rather than BgzfBlockReader which inflates in parallel
+ * */
+template<class T, template<class...> class Container = std::vector, class Reader = FormatBlockReader>
+class ReadAheadBlockQueue
+{
+public:
+    using reader_type = Reader;
+    using container_type = Container<T>;
+    using policies = linear_container_policy<Container, T>;
+
+    /* # of blocks read ahead */
+    constexpr static size_t ring_size = 16;
+public:
+    /* fields: those of RecordFields to be read, see read_policy::read */
+    /* see MultiThreadSafeBlockQueue; with lookahead, the largest of the next lookahead + 1 blocks is handed out
+     * first, e.g. a long read alone in its block, so that it does not start last and leave the other workers
+     * idle at the end; no block is handed out more than lookahead blocks after those following it.
+     * Once budget is spent, no more is read ahead and the reader waits with nothing left to hand out */
+    ReadAheadBlockQueue(reader_type &reader, int size, unsigned fields = k_all_fields, BatchSizer *sizer = nullptr,
+                        size_t lookahead = 0, MemoryBudget *budget = nullptr)
+        : reader_(reader), size_(size), fields_(fields), sizer_(sizer), lookahead_(lookahead), budget_(budget),
+          thread_(&ReadAheadBlockQueue::produce, this)
+    { }
+
+    ReadAheadBlockQueue(const ReadAheadBlockQueue &) = delete;
+
+    ReadAheadBlockQueue &operator=(const ReadAheadBlockQueue &) = delete;
+
+    ~ReadAheadBlockQueue()
+    {
+        stop_.store(true);
+        thread_.join();
+    }
+
+    /* records own all their fields, as block is gone once they are returned */
+    container_type get()
+    {
+        std::string block;
+        BlockPosition pos;
+        return get(block, pos, fields_ | k_field_owned);
+    }
+
+    /* as get(), the records are read from block, which is kept to let them refer to their raw bytes */
+    container_type get(std::string &block)
+    {
+        BlockPosition pos;
+        return get(block, pos);
+    }
+
+    /* as get(block), pos is set to the position of the batch in the input */
+    container_type get(std::string &block, BlockPosition &pos)
+    {
+        return get(block, pos, fields_);
+    }
+
+    /* as get(block, pos), into ret, the records of a batch done with, see readRecords */
+    void get(container_type &ret, std::string &block, BlockPosition &pos)
+    {
+        if (next(block, pos)) {
+            readRecords(ret, block, fields_);
+        } else {
+            ret.clear();
+        }
+    }
+
+    QueueStats stats() const
+    {
+        QueueStats stats;
+        stats.empty_waits = empty_waits_.load();
+        stats.full_waits = full_waits_.load();
+        stats.read_seconds = read_seconds_; /* only meaningful once the thread is done */
+        return stats;
+    }
+
+private:
+    struct Slot
+    {
+        std::string block;
+        BlockPosition pos;
+    };
+
+    /* a block read but not yet in the ring, see lookahead */
+    struct Pending
+    {
+        Slot slot;
+        size_t passed; /* # of blocks after it in the input pushed before it */
+    };
+
+    void produce()
+    {
+        std::deque<Pending> pending; /* in the order of the input */
+        bool eof = false;
+        while (true) {
+            while (!eof && pending.size() <= lookahead_) {
+                if (budget_ && budget_->spent()) {
+                    if (!pending.empty()) {
+                        break;
+                    }
+                    budget_->wait();
+                }
+                pending.emplace_back();
+                spare_.pop(pending.back().slot.block); /* with the capacity of a block done with, if any */
+                auto start = std::chrono::steady_clock::now();
+                eof = !reader_.template next<T>(pending.back().slot.block, size_, pending.back().slot.pos,
+                                                sizer_ ? sizer_->bytes() : std::numeric_limits<size_t>::max());
+                read_seconds_ += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (budget_) {
+                    budget_->charge(pending.back().slot.block.size());
+                }
+                if (eof) {
+                    pending.pop_back();
+                }
+            }
+            if (pending.empty()) {
+                break;
+            }
+            /* the largest block goes first, unless the oldest one has been passed over lookahead times */
+            size_t k = 0;
+            if (pending.front().passed < lookahead_) {
+                for (size_t i = 1; i < pending.size(); ++i) {
+                    if (pending[i].slot.block.size() > pending[k].slot.block.size()) {
+                        k = i;
+                    }
+                }
+            }
+            for (size_t i = 0; i < k; ++i) {
+                ++pending[i].passed;
+            }
+            while (!ring_.push(pending[k].slot)) {
+                if (stop_.load()) {
+                    return;
+                }
+                full_waits_.fetch_add(1, std::memory_order_relaxed);
+                space_.wait();
+            }
+            pending.erase(pending.begin() + k);
+            work_.ring();
+        }
+        done_.store(true);
+        work_.ring();
+    }
+
+    container_type get(std::string &block, BlockPosition &pos, unsigned fields)
+    {
+        container_type ret;
+        if (!next(block, pos)) {
+            return ret;
+        }
+        if (!sizer_) {
+            policies::reserve(ret, size_);
+        }
+        readRecords(ret, block, fields);
+        return ret;
+    }
+
+    /* the next block, swapped into block, whose old buffer goes back to the reader to be refilled; false, with
+     * block empty, at the end of input */
+    bool next(std::string &block, BlockPosition &pos)
+    {
+        Slot slot;
+        while (!ring_.pop(slot)) {
+            bool done = done_.load(); /* anything pushed before done is popped below */
+            if (ring_.pop(slot)) {
+                break;
+            }
+            if (done) {
+                block.clear();
+                return false;
+            }
+            empty_waits_.fetch_add(1, std::memory_order_relaxed);
+            work_.wait();
+        }
+        space_.ring();
+        block.swap(slot.block);
+        pos = slot.pos;
+        if (slot.block.capacity()) {
+            spare_.push(slot.block);
+        }
+        return true;
+    }
+
+    reader_type &reader_;
+    int size_;
+    unsigned fields_;
+    BatchSizer *sizer_;
+    size_t lookahead_;
+    MemoryBudget *budget_;
+    MpmcRing<Slot, ring_size> ring_;
+    MpmcRing<std::string, ring_size> spare_; /* buffers of blocks handed out, see next() */
+    Doorbell work_; /* the ring is no longer empty */
+    Doorbell space_; /* the ring is no longer full */
+    std::atomic<bool> done_{false};
+    std::atomic<bool> stop_{false};
+    std::atomic<uint64_t> empty_waits_{0};
+    std::atomic<uint64_t> full_waits_{0};
+    double read_seconds_ = 0; /* written by the thread only, read once it is done */
+    std::thread thread_; /* last, to start once the rest is built */
+};
+
 #endif //TRIMISOSEQPOLYA_THREAD_H
@@ -0,0 +1,237 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+
+#ifndef topology_hpp
+#define topology_hpp
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#endif
+
+/* CPUs of the machine and the NUMA nodes they belong to, as far as threads are concerned; read from sysfs so
+ * that libnuma is not needed */
+
+/* CPUs in a kernel cpulist, like "0-3,8,10-11" */
+inline std::vector<int> parseCpuList(const std::string& list) {
+    std::vector<int> cpus;
+    const char *p = list.c_str();
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long c = first; c <= last; ++c)
+            cpus.push_back(static_cast<int>(c));
+        while (*p == ',' || *p == '\n' || *p == ' ')
+            ++p;
+    }
+    return cpus;
+}
+
+/* first line of a small file, empty if it cannot be read */
+inline std::string readLine(const std::string& file) {
+    std::string line;
+    FILE *f = fopen(file.c_str(), "r");
+    if (!f)
+        return line;
+    char buf[4096];
+    if (fgets(buf, sizeof(buf), f))
+        line = buf;
+    fclose(f);
+    return line;
+}
+
+/* CPUs this process may run on, by its affinity mask, or all of them where it cannot be told */
+inline std::vector<int> allowedCpus() {
+    std::vector<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int c = 0; c < CPU_SETSIZE; ++c)
+            if (CPU_ISSET(c, &set))
+                cpus.push_back(c);
+    }
+#endif
+    if (cpus.empty()) {
+        for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); ++c)
+            cpus.push_back(c);
+    }
+    return cpus;
+}
+
+/* NUMA node of each CPU, indexed by CPU; all 0 on machines without nodes in sysfs */
+inline std::vector<int> cpuNodes(const std::string& sysfs = "/sys/devices/system/node") {
+    std::vector<int> nodes;
+    for (int node = 0; ; ++node) {
+        std::string list = readLine(sysfs + "/node" + std::to_string(node) + "/cpulist");
+        if (list.empty())
+            break;
+        for (int c : parseCpuList(list)) {
+            if (static_cast<size_t>(c) >= nodes.size())
+                nodes.resize(c + 1, 0);
+            nodes[c] = node;
+        }
+    }
+    return nodes;
+}
+
+inline int nodeOf(const std::vector<int>& nodes, int cpu) {
+    return static_cast<size_t>(cpu) < nodes.size() ? nodes[cpu] : 0;
+}
+
+/* cpus ordered to pin threads to one after another: those of a node before the next, so that threads started
+ * together share a node and the memory they touch */
+inline std::vector<int> pinningOrder(std::vector<int> cpus, const std::vector<int>& nodes) {
+    std::stable_sort(cpus.begin(), cpus.end(), [&nodes](int a, int b) {
+        return nodeOf(nodes, a) < nodeOf(nodes, b);
+    });
+    return cpus;
+}
+
+/* pin thread t to cpu; false where threads cannot be pinned */
+inline bool pinThread(std::thread& t, int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void) t;
+    (void) cpu;
+    return false;
+#endif
+}
+
+/* CPUs granted by a cgroup v2 "cpu.max" line, "quota period" in microseconds, 0 for no limit ("max") */
+inline double parseCpuMax(const std::string& line) {
+    char quota[32];
+    unsigned long period = 0;
+    if (sscanf(line.c_str(), "%31s %lu", quota, &period) != 2 || !period || !strcmp(quota, "max"))
+        return 0;
+    return strtod(quota, nullptr) / period;
+}
+
+/* CPUs granted by the cgroup v1 files cpu.cfs_quota_us and cpu.cfs_period_us in dir, 0 for no limit (-1) */
+inline double parseCfsQuota(const std::string& dir) {
+    long quota = strtol(readLine(dir + "/cpu.cfs_quota_us").c_str(), nullptr, 10);
+    long period = strtol(readLine(dir + "/cpu.cfs_period_us").c_str(), nullptr, 10);
+    return quota > 0 && period > 0 ? static_cast<double>(quota) / period : 0;
+}
+
+/* the tightest of the CPU limits, by limitOf(directory), of the cgroup at path under mount and of the parents of
+ * it, 0 for none */
+template <class F>
+inline double tightestCpuLimit(const std::string& mount, std::string path, F limitOf) {
+    double limit = 0;
+    while (true) {
+        double cpus = limitOf(mount + path);
+        if (cpus > 0 && (limit == 0 || cpus < limit))
+            limit = cpus;
+        size_t slash = path.find_last_of('/');
+        if (path.empty() || slash == std::string::npos)
+            break;
+        path.erase(slash);
+    }
+    return limit;
+}
+
+/* CPUs granted to this process by its cgroup CPU quota, e.g. under Slurm or Kubernetes, 0 for no limit; the
+ * tightest of those of its cgroup, as listed in self, and the parents of it under root: that of the v2 hierarchy,
+ * "0::path", or else that of the v1 hierarchy of the cpu controller, e.g. "4:cpu,cpuacct:path", mounted at
+ * root/cpu or at root/cpu,cpuacct */
+inline double cgroupCpuLimit(const std::string& root = "/sys/fs/cgroup",
+                             const std::string& self = "/proc/self/cgroup") {
+    std::string group, v1_group, v1_controllers;
+    FILE *f = fopen(self.c_str(), "r");
+    if (f) {
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), f)) {
+            std::string line(buf);
+            line.erase(line.find_last_not_of("\n") + 1);
+            size_t first = line.find(':');
+            size_t second = first == std::string::npos ? first : line.find(':', first + 1);
+            if (second == std::string::npos)
+                continue;
+            std::string controllers = line.substr(first + 1, second - first - 1);
+            if (!line.compare(0, first, "0") && controllers.empty()) { /* the v2 hierarchy */
+                group = line.substr(second + 1);
+            } else if (("," + controllers + ",").find(",cpu,") != std::string::npos) {
+                v1_group = line.substr(second + 1);
+                v1_controllers = controllers;
+            }
+        }
+        fclose(f);
+    }
+    double limit = tightestCpuLimit(root, group, [](const std::string& dir) {
+        return parseCpuMax(readLine(dir + "/cpu.max"));
+    });
+    if (limit == 0)
+        limit = tightestCpuLimit(root + "/cpu", v1_group, parseCfsQuota);
+    if (limit == 0 && !v1_controllers.empty() && v1_controllers != "cpu")
+        limit = tightestCpuLimit(root + "/" + v1_controllers, v1_group, parseCfsQuota);
+    return limit;
+}
+
+/* # of CPUs this process can keep busy: its affinity mask, e.g. a Slurm allocation, capped by its cgroup CPU
+ * quota rounded up and by the CPUs of the machine */
+inline int availableCpus() {
+    size_t cpus = allowedCpus().size();
+    unsigned hardware = std::thread::hardware_concurrency();
+    if (hardware)
+        cpus = std::min<size_t>(cpus, hardware);
+    double quota = cgroupCpuLimit();
+    if (quota > 0)
+        cpus = std::min<size_t>(cpus, static_cast<size_t>(ceil(quota)));
+    return static_cast<int>(std::max<size_t>(cpus, 1));
+}
+
+#endif /* topology_hpp */
@@ -42,6 +42,7 @@
 #include <list>
 #include <deque>
 #include <string>
+#include <iterator>
 
 template<class T>
 struct read_policy
@@ -116,6 +117,12 @@ struct linear_container_policy<std::vector, T, Args...>
     {
         return c.empty();
     }
+
+    /* keep the first n items only */
+    static void truncate(container_t &c, size_type n)
+    {
+        c.erase(std::next(c.begin(), n), c.end());
+    }
 };
 
 // policies for list
@@ -147,6 +154,12 @@ struct linear_container_policy<std::list, T, Args...>
     {
         return c.empty();
     }
+
+    /* keep the first n items only */
+    static void truncate(container_t &c, size_type n)
+    {
+        c.erase(std::next(c.begin(), n), c.end());
+    }
 };
 
 // policies for deque
@@ -178,6 +191,12 @@ struct linear_container_policy<std::deque, T, Args...>
     {
         return c.empty();
     }
+
+    /* keep the first n items only */
+    static void truncate(container_t &c, size_type n)
+    {
+        c.erase(std::next(c.begin(), n), c.end());
+    }
 };
 
 #endif /* type_policy_h */
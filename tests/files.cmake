@@ -7,7 +7,16 @@ set(TrimIsoseqPolyA_Test_CPP
     ${TrimIsoseqPolyA_TestsDir}/src/fasta_test.cpp
     ${TrimIsoseqPolyA_TestsDir}/src/fastq_test.cpp
     ${TrimIsoseqPolyA_TestsDir}/src/hmm_model_test.cpp
+    ${TrimIsoseqPolyA_TestsDir}/src/io_backend_test.cpp
     ${TrimIsoseqPolyA_TestsDir}/src/matrix_test.cpp
     ${TrimIsoseqPolyA_TestsDir}/src/polyA_HMM_test.cpp
+    ${TrimIsoseqPolyA_TestsDir}/src/results_test.cpp
     ${TrimIsoseqPolyA_TestsDir}/src/sequence_test.cpp
+    ${TrimIsoseqPolyA_TestsDir}/src/shard_test.cpp
+    ${TrimIsoseqPolyA_TestsDir}/src/thread_test.cpp
+    ${TrimIsoseqPolyA_TestsDir}/src/topology_test.cpp
 )
+
+if (SUPPORT_BAM)
+    list(APPEND TrimIsoseqPolyA_Test_CPP ${TrimIsoseqPolyA_TestsDir}/src/bam_test.cpp)
+endif ()
@@ -14,6 +14,8 @@ namespace tests {
     const std::string testReader_Fasta      = Data_Dir + "testReader.fa";
     const std::string polyA_Fasta           = Data_Dir + "polyA.fa";
     const std::string polyA_Fastq           = Data_Dir + "polyA.fq";
+    const std::string polyA_Bgzf_Fastq      = Data_Dir + "polyA.fq.gz";
+    const std::string polyA_Bam             = Data_Dir + "polyA.bam";
     const std::string polyA_train_Fasta     = Data_Dir + "polyA_train.fa";
     const std::string non_polyA_train_Fasta = Data_Dir + "non_polyA_train.fa";
     const std::string hmm_Default_Out       = Out_Dir + "HMM_default.txt";
@@ -0,0 +1,253 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#include <string>
+#include "bam.hpp"
+#include "fastq.hpp"
+#include "thread.hpp"
+#include "gmock/gmock.h"
+#include "TestData.h"
+
+using namespace std;
+namespace {
+
+TEST(BgzfTest, DetectBgzf)
+{
+    EXPECT_TRUE(isBgzfFile(tests::polyA_Bam));
+    EXPECT_TRUE(isBgzfFile(tests::polyA_Bgzf_Fastq));
+    EXPECT_FALSE(isBgzfFile(tests::polyA_Fastq));
+}
+
+TEST(BgzfTest, BgzfFastqMatchesPlain)
+{
+    BgzfBlockReader reader(tests::polyA_Bgzf_Fastq);
+    EXPECT_EQ(reader.peek(), '@');
+    MultiThreadSafeBlockQueue<Fastq<>, std::vector, BgzfBlockReader> queue(reader, 100);
+    auto data = queue.get();
+    EXPECT_TRUE(queue.get().empty());
+    FastqReader<> plain(tests::polyA_Fastq);
+    auto fq = plain.begin();
+    ASSERT_EQ(data.size(), 2);
+    for (auto &rec : data) {
+        EXPECT_EQ(rec.name_, fq->name_);
+        EXPECT_TRUE(rec == *fq);
+        EXPECT_EQ(rec.quality_, fq->quality_);
+        ++fq;
+    }
+}
+
+TEST(BamTest, BamMatchesFastq)
+{
+    BgzfBlockReader reader(tests::polyA_Bam);
+    EXPECT_EQ(reader.peek(), 'B');
+    std::string header;
+    ASSERT_TRUE(readBamHeader(reader, header));
+    EXPECT_EQ(header.compare(0, 4, "BAM\1"), 0);
+    MultiThreadSafeBlockQueue<Bam<>, std::vector, BgzfBlockReader> queue(reader, 100);
+    auto data = queue.get();
+    EXPECT_TRUE(queue.get().empty());
+    FastqReader<> plain(tests::polyA_Fastq);
+    auto fq = plain.begin();
+    ASSERT_EQ(data.size(), 2);
+    for (auto &rec : data) {
+        EXPECT_EQ(rec.name_, fq->name_.substr(0, fq->name_.find(' ')));
+        EXPECT_TRUE(rec == *fq); // case insensitive
+        EXPECT_EQ(rec.quality_, fq->quality_);
+        EXPECT_EQ(rec.flag_, 4);
+        EXPECT_EQ(rec.aux_.substr(0, 3), "zmi");
+        ++fq;
+    }
+    EXPECT_EQ(data[0].size(), 469);
+    EXPECT_EQ(data[1].size(), 601);
+}
+
+TEST(BgzfTest, CompressRoundTrip)
+{
+    std::string data;
+    for (int i = 0; i < 100000; ++i) {
+        data += "ACGT"[i * 7 % 4];
+    }
+    OutputArena arena;
+    compressBgzf(data.data(), data.size(), arena);
+    std::string compressed(arena.data(), arena.size());
+    EXPECT_EQ(k_bgzf_eof_size, 28);
+    std::string inflated;
+    size_t blocks = 0;
+    for (size_t off = 0; off < compressed.size(); ++blocks) {
+        ASSERT_TRUE(isBgzfHeader(compressed.data() + off));
+        size_t size = bgzfBlockSize(compressed.data() + off);
+        ASSERT_TRUE(inflateBgzfBlock(compressed.data() + off, size, inflated));
+        off += size;
+    }
+    EXPECT_EQ(blocks, 2);
+    EXPECT_EQ(inflated, data);
+}
+
+TEST(BgzfTest, MalformedBlock)
+{
+    std::string eof(k_bgzf_eof, k_bgzf_eof_size);
+    ASSERT_TRUE(isBgzfHeader(eof.data()));
+    /* BSIZE too small for the header and footer */
+    std::string small = eof;
+    small[16] = 10;
+    EXPECT_FALSE(isBgzfHeader(small.data()));
+    std::string inflated;
+    EXPECT_FALSE(inflateBgzfBlock(small.data(), bgzfBlockSize(small.data()), inflated));
+    /* ISIZE beyond the 64 KiB a block inflates to at most */
+    OutputArena arena;
+    compressBgzf("ACGT", 4, arena);
+    std::string block(arena.data(), bgzfBlockSize(arena.data()));
+    block[block.size() - 2] = 2; /* ISIZE = 4 + (2 << 16) */
+    EXPECT_FALSE(inflateBgzfBlock(block.data(), block.size(), inflated));
+    EXPECT_TRUE(inflated.empty());
+}
+
+TEST(BamTest, MalformedAuxArray)
+{
+    std::string aux("XBBc", 4);
+    int32_t count = -1;
+    aux.append(reinterpret_cast<const char *>(&count), 4);
+    aux += "ab";
+    std::string out;
+    EXPECT_EXIT(bamAuxAppendExcept(aux.data(), aux.data() + aux.size(), k_bam_polya_tag, out),
+                ::testing::ExitedWithCode(EXIT_FAILURE), "ill-formatted array");
+    count = 3; /* more values than there are */
+    memcpy(&aux[4], &count, 4);
+    EXPECT_EXIT(bamAuxAppendExcept(aux.data(), aux.data() + aux.size(), k_bam_polya_tag, out),
+                ::testing::ExitedWithCode(EXIT_FAILURE), "ill-formatted array");
+    count = 2;
+    memcpy(&aux[4], &count, 4);
+    bamAuxAppendExcept(aux.data(), aux.data() + aux.size(), k_bam_polya_tag, out);
+    EXPECT_EQ(out, aux);
+}
+
+TEST(BamTest, WritePolicyRoundTrip)
+{
+    BgzfBlockReader reader(tests::polyA_Bam);
+    std::string header;
+    ASSERT_TRUE(readBamHeader(reader, header));
+    MultiThreadSafeBlockQueue<Bam<>, std::vector, BgzfBlockReader> queue(reader, 100);
+    auto data = queue.get();
+    ASSERT_EQ(data.size(), 2);
+    OutputArena buf;
+    /* the second read has a 57 nt polyA tail */
+    bam_write_policy<Bam<> >::write(buf, data[1], 57);
+    size_t n = buf.size();
+    size_t found = 10;
+    bool eof = false;
+    EXPECT_EQ(read_policy<Bam<> >::scan(buf.data(), buf.data() + n, found, eof), buf.data() + n);
+    EXPECT_EQ(found, 1);
+    const char *p = buf.data();
+    auto rec = read_policy<Bam<> >::read(p, buf.data() + n);
+    EXPECT_EQ(rec.name_, data[1].name_);
+    EXPECT_EQ(rec.size(), 601 - 57);
+    EXPECT_EQ(rec.quality_, data[1].quality_.substr(0, 601 - 57));
+    EXPECT_TRUE(rec.seq_ == data[1].seq_.substr(0, 601 - 57));
+    /* input tags kept, polyA length appended */
+    EXPECT_EQ(rec.aux_.substr(0, data[1].aux_.size()), data[1].aux_);
+    EXPECT_EQ(rec.aux_.substr(data[1].aux_.size(), 3), "pAi");
+    EXPECT_EQ(bamInt32(rec.aux_.data() + data[1].aux_.size() + 3), 57);
+    /* writing it again replaces the tag */
+    buf.clear();
+    bam_write_policy<Bam<> >::write(buf, rec, 0);
+    n = buf.size();
+    p = buf.data();
+    auto again = read_policy<Bam<> >::read(p, buf.data() + n);
+    EXPECT_EQ(again.aux_.size(), rec.aux_.size());
+    EXPECT_EQ(bamInt32(again.aux_.data() + data[1].aux_.size() + 3), 0);
+    /* a quality shorter than the sequence is written as missing */
+    rec.quality_.resize(10);
+    buf.clear();
+    bam_write_policy<Bam<> >::write(buf, rec, 0);
+    p = buf.data();
+    again = read_policy<Bam<> >::read(p, buf.data() + buf.size());
+    EXPECT_TRUE(again.quality_.empty());
+    EXPECT_TRUE(again.seq_ == rec.seq_);
+}
+
+TEST(BamTest, WriteReadName)
+{
+    Fastq<> fq;
+    fq.name_ = "read/1 strand=+;fiveseen=1";
+    fq.seq_ = "ACGTAAAA";
+    fq.quality_ = "!!!!####";
+    OutputArena buf;
+    bam_write_policy<Fastq<> >::write(buf, fq, 4);
+    const char *p = buf.data();
+    auto rec = read_policy<Bam<> >::read(p, buf.data() + buf.size());
+    EXPECT_EQ(rec.name_, "read/1"); /* no whitespace in a BAM read name */
+    EXPECT_TRUE(rec.seq_ == "ACGT");
+    /* a name longer than BAM takes is cut, the rest of the record left intact */
+    fq.name_.assign(301, 'n');
+    buf.clear();
+    bam_write_policy<Fastq<> >::write(buf, fq, 0);
+    p = buf.data();
+    rec = read_policy<Bam<> >::read(p, buf.data() + buf.size());
+    EXPECT_EQ(p, buf.data() + buf.size());
+    EXPECT_EQ(rec.name_, std::string(k_bam_max_name_size, 'n'));
+    EXPECT_TRUE(rec.seq_ == "ACGTAAAA");
+    EXPECT_EQ(rec.quality_, fq.quality_);
+}
+
+TEST(BamTest, MalformedRecord)
+{
+    Bam<> rec;
+    rec.name_ = "r";
+    rec.seq_ = "ACGTACGT";
+    OutputArena buf;
+    bam_write_policy<Bam<> >::write(buf, rec, 0);
+    std::string s(buf.data(), buf.size());
+    /* l_seq beyond block_size */
+    int32_t l_seq = 1000;
+    memcpy(&s[4 + 16], &l_seq, 4);
+    size_t found = 1;
+    bool eof = false;
+    EXPECT_EQ(read_policy<Bam<> >::scan(s.data(), s.data() + s.size(), found, eof), s.data());
+    EXPECT_EQ(found, 0);
+    EXPECT_TRUE(eof);
+    const char *p = s.data();
+    auto bad = read_policy<Bam<> >::read(p, s.data() + s.size());
+    EXPECT_EQ(p, s.data() + s.size());
+    EXPECT_TRUE(bad.seq_.empty());
+    /* block_size beyond the data */
+    std::string t(buf.data(), buf.size() - 1);
+    p = t.data();
+    bad = read_policy<Bam<> >::read(p, t.data() + t.size());
+    EXPECT_EQ(p, t.data() + t.size());
+    EXPECT_TRUE(bad.name_.empty());
+}
+}
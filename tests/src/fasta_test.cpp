@@ -79,6 +79,43 @@ TEST_F(FastaTest, FastaReaderForLoop)
     }
 }
 
+TEST(FastaBlockTest, BlockReaderMatchesIterator)
+{
+    FormatBlockReader block_reader(tests::polyA_Fasta);
+    FastaReader<> iter_reader(tests::polyA_Fasta);
+    auto fa = iter_reader.begin();
+    std::string block;
+    size_t n = 0;
+    while (block_reader.next<Fasta<> >(block, 3)) {
+        const char *p = block.data();
+        while (p != block.data() + block.size()) {
+            auto rec = read_policy<Fasta<> >::read(p, block.data() + block.size());
+            EXPECT_EQ(rec.name_, fa->name_);
+            EXPECT_TRUE(rec == *fa);
+            ++fa;
+            ++n;
+        }
+    }
+    EXPECT_TRUE(*fa == Fasta<>{});
+    EXPECT_GT(n, 0);
+}
+
+TEST(FastaWriteTest, WritePolicy)
+{
+    Fasta<> fa;
+    fa.name_ = "read1";
+    fa.seq_ = "ACGTAAAA";
+    OutputArena buf;
+    write_policy<Fasta<> >::write(buf, fa, 4);
+    EXPECT_EQ(std::string(buf.data(), buf.size()), ">read1\nACGT\n");
+    buf.clear();
+    write_policy<Fasta<> >::write(buf, fa, 0);
+    EXPECT_EQ(std::string(buf.data(), buf.size()), ">read1\nACGTAAAA\n");
+    buf.clear();
+    write_policy<Fasta<> >::writeColor(buf, fa, 4);
+    EXPECT_EQ(std::string(buf.data(), buf.size()), ">read1\nACGT" KERNAL_RED "AAAA\n" KERNAL_RESET);
+}
+
 TEST_F(FastaTest, FastaSequence)
 {
     auto faiter = reader.begin();
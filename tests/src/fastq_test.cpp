@@ -37,6 +37,7 @@
 #include <string>
 #include <iostream>
 #include "fastq.hpp"
+#include "thread.hpp"
 #include "gmock/gmock.h"
 #include "TestData.h"
 
@@ -80,6 +81,249 @@ namespace {
         }
     }
     
+    TEST(FastqBlockTest, BlockReaderMatchesIterator)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        FastqReader<> iter_reader(tests::polyA_Fastq);
+        auto fq = iter_reader.begin();
+        std::string block;
+        int n = 0;
+        while (block_reader.next<Fastq<> >(block, 1)) {
+            const char *p = block.data();
+            auto rec = read_policy<Fastq<> >::read(p, block.data() + block.size());
+            EXPECT_EQ(p, block.data() + block.size());
+            EXPECT_EQ(rec.name_, fq->name_);
+            EXPECT_TRUE(rec == *fq);
+            EXPECT_EQ(rec.quality(), fq->quality_);
+            ++fq;
+            ++n;
+        }
+        EXPECT_EQ(n, 2);
+    }
+
+    TEST(FastqBlockTest, ScanIncompleteRecord)
+    {
+        std::string s = "@a\nACGT\n+\n!!!!\n@b\nAC";
+        size_t n = 10;
+        bool eof = false;
+        const char *e = read_policy<Fastq<> >::scan(s.data(), s.data() + s.size(), n, eof);
+        EXPECT_EQ(n, 1);
+        EXPECT_EQ(e - s.data(), 15);
+        n = 10;
+        eof = true;
+        e = read_policy<Fastq<> >::scan(s.data(), s.data() + s.size(), n, eof);
+        EXPECT_EQ(n, 2);
+        EXPECT_EQ(e, s.data() + s.size());
+    }
+
+    TEST(FastqBlockTest, BlockQueue)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        MultiThreadSafeBlockQueue<Fastq<>, std::vector> queue(block_reader, 100);
+        auto data = queue.get();
+        ASSERT_EQ(data.size(), 2);
+        EXPECT_EQ(data[0].size(), 469);
+        EXPECT_EQ(data[1].size(), 601);
+        EXPECT_EQ(data[1].quality_.size(), 601);
+        EXPECT_TRUE(queue.get().empty());
+    }
+
+    TEST(FastqBlockTest, BlockSequenceNumbers)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        MultiThreadSafeBlockQueue<Fastq<>, std::vector> queue(block_reader, 1);
+        std::string block;
+        BlockPosition pos;
+        pos.seq = 10;
+        EXPECT_EQ(queue.get(block, pos).size(), 1);
+        EXPECT_EQ(pos.seq, 0);
+        EXPECT_EQ(pos.first, 0);
+        EXPECT_EQ(queue.get(block, pos).size(), 1);
+        EXPECT_EQ(pos.seq, 1);
+        EXPECT_EQ(pos.first, 1);
+        EXPECT_TRUE(queue.get(block, pos).empty());
+    }
+
+    TEST(FastqBlockTest, MaxBytes)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        std::string block;
+        BlockPosition pos;
+        /* the first record is longer than max_bytes, so it goes alone */
+        ASSERT_TRUE(block_reader.next<Fastq<>>(block, 100, pos, 10));
+        EXPECT_EQ(pos.first, 0);
+        ASSERT_TRUE(block_reader.next<Fastq<>>(block, 100, pos, 1 << 20));
+        EXPECT_EQ(pos.first, 1);
+        EXPECT_FALSE(block_reader.next<Fastq<>>(block, 100, pos, 10));
+    }
+
+    TEST(FastqBlockTest, ReadAhead)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        ReadAheadBlockQueue<Fastq<>, std::vector> queue(block_reader, 1);
+        std::string block;
+        BlockPosition pos;
+        auto data = queue.get(block, pos);
+        ASSERT_EQ(data.size(), 1);
+        EXPECT_EQ(pos.seq, 0);
+        EXPECT_EQ(data[0].size(), 469);
+        EXPECT_EQ(queue.get(block, pos).size(), 1);
+        EXPECT_EQ(pos.seq, 1);
+        EXPECT_TRUE(queue.get(block, pos).empty());
+        EXPECT_TRUE(queue.get().empty());
+    }
+
+    TEST(FastqBlockTest, LookaheadLargestFirst)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        ReadAheadBlockQueue<Fastq<>, std::vector> queue(block_reader, 1, k_all_fields, nullptr, 1);
+        std::string block;
+        BlockPosition pos;
+        auto data = queue.get(block, pos);
+        ASSERT_EQ(data.size(), 1);
+        EXPECT_EQ(pos.seq, 1);
+        EXPECT_EQ(data[0].size(), 601);
+        data = queue.get(block, pos);
+        ASSERT_EQ(data.size(), 1);
+        EXPECT_EQ(pos.seq, 0);
+        EXPECT_TRUE(queue.get(block, pos).empty());
+    }
+
+    TEST(FastqBlockTest, ReuseRecords)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        ReadAheadBlockQueue<Fastq<>, std::vector> queue(block_reader, 1, k_field_quality);
+        std::string block;
+        BlockPosition pos;
+        std::vector<Fastq<> > data(3); /* more records than a batch, e.g. those of a larger one */
+        data[0].quality_ = "left over";
+        data[0].seq_.reserve(1000);
+        const char *seq = data[0].seq_.data();
+        queue.get(data, block, pos);
+        ASSERT_EQ(data.size(), 1);
+        EXPECT_EQ(data[0].size(), 469);
+        EXPECT_TRUE(data[0].quality_.empty());
+        EXPECT_EQ(data[0].qualitySize(), 469);
+        queue.get(data, block, pos);
+        ASSERT_EQ(data.size(), 1);
+        EXPECT_EQ(data[0].size(), 601);
+        EXPECT_EQ(data[0].seq_.data(), seq); /* read into the same buffer */
+        queue.get(data, block, pos);
+        EXPECT_TRUE(data.empty());
+    }
+
+    TEST(FastqBlockTest, StreamingHandsOutPartialBlock)
+    {
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        const std::string record = "@a\nACGTAA\n+\n!!!!##\n";
+        ASSERT_EQ(write(fds[1], record.data(), record.size()), static_cast<ssize_t>(record.size()));
+        FormatBlockReader block_reader("/dev/fd/" + std::to_string(fds[0]), std::chrono::milliseconds(10));
+        std::string block;
+        BlockPosition pos;
+        /* the writer end is still open, the record is handed out alone once it has waited */
+        ASSERT_TRUE(block_reader.next<Fastq<> >(block, 100, pos));
+        EXPECT_EQ(block, record);
+        EXPECT_GE(std::chrono::steady_clock::now() - pos.ready, std::chrono::milliseconds(10));
+        close(fds[1]);
+        EXPECT_FALSE(block_reader.next<Fastq<> >(block, 100, pos));
+        close(fds[0]);
+    }
+
+    TEST(FastqBlockTest, SkipQuality)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        MultiThreadSafeBlockQueue<Fastq<>, std::vector> queue(block_reader, 100, 0);
+        auto data = queue.get();
+        ASSERT_EQ(data.size(), 2);
+        EXPECT_EQ(data[1].size(), 601);
+        EXPECT_TRUE(data[1].quality_.empty());
+    }
+
+    TEST(FastqBlockTest, LazyQuality)
+    {
+        FormatBlockReader block_reader(tests::polyA_Fastq);
+        MultiThreadSafeBlockQueue<Fastq<>, std::vector> queue(block_reader, 100, k_field_quality);
+        std::string block;
+        auto data = queue.get(block);
+        ASSERT_EQ(data.size(), 2);
+        /* located in the block, not copied */
+        EXPECT_TRUE(data[1].quality_.empty());
+        EXPECT_EQ(data[1].qualitySize(), 601);
+        EXPECT_GE(data[1].qualityData(), block.data());
+        EXPECT_LT(data[1].qualityData(), block.data() + block.size());
+        const std::string quality(data[1].qualityData(), data[1].qualitySize());
+        EXPECT_EQ(data[1].quality(), quality);
+        EXPECT_EQ(data[1].quality_, quality);
+    }
+
+    TEST(FastqWriteTest, GatherMatchesWrite)
+    {
+        std::string s = "@a\nACGTAA\n+\n!!!!##\n@b c\nACGTAA\n+b c\n!!!!##\n";
+        const char *p = s.data();
+        const char *e = p + s.size();
+        OutputArena buf;
+        while (p != e) {
+            auto fq = read_policy<Fastq<> >::read(p, e);
+            for (size_t trimmed : {0, 2}) {
+                std::vector<iovec> iov;
+                write_policy<Fastq<> >::gather(iov, fq, trimmed);
+                std::string gathered;
+                for (auto &v : iov) {
+                    gathered.append(static_cast<const char *>(v.iov_base), v.iov_len);
+                }
+                buf.clear();
+                write_policy<Fastq<> >::write(buf, fq, trimmed);
+                EXPECT_EQ(gathered, std::string(buf.data(), buf.size()));
+            }
+        }
+        /* the first record is sent as it was read */
+        p = s.data();
+        auto fq = read_policy<Fastq<> >::read(p, e);
+        std::vector<iovec> iov;
+        write_policy<Fastq<> >::gather(iov, fq, 0);
+        ASSERT_EQ(iov.size(), 1);
+        EXPECT_EQ(iov[0].iov_base, s.data());
+    }
+
+    TEST(FastqWriteTest, QualityShorterThanSequence)
+    {
+        std::string s = "@a\nACGTAAAA\n+\n!!!\n";
+        const char *p = s.data();
+        auto fq = read_policy<Fastq<> >::read(p, s.data() + s.size());
+        OutputArena buf;
+        write_policy<Fastq<> >::write(buf, fq, 4);
+        EXPECT_EQ(std::string(buf.data(), buf.size()), "@a\nACGT\n+\n!!!\n");
+        buf.clear();
+        write_policy<Fastq<> >::write(buf, fq, 6);
+        EXPECT_EQ(std::string(buf.data(), buf.size()), "@a\nAC\n+\n!!\n");
+        std::vector<iovec> iov;
+        write_policy<Fastq<> >::gather(iov, fq, 6);
+        std::string gathered;
+        for (auto &v : iov) {
+            gathered.append(static_cast<const char *>(v.iov_base), v.iov_len);
+        }
+        EXPECT_EQ(gathered, std::string(buf.data(), buf.size()));
+        buf.clear();
+        write_policy<Fastq<> >::writeColor(buf, fq, 6);
+        EXPECT_EQ(std::string(buf.data(), buf.size()),
+                  "@a\nAC" KERNAL_RED "GTAAAA" KERNAL_RESET "\n+\n!!" KERNAL_RED "!\n" KERNAL_RESET);
+    }
+
+    TEST(FastqWriteTest, WriteLongRecord)
+    {
+        /* longer than any fixed buffer would have assumed */
+        Fastq<> fq;
+        fq.name_ = "long";
+        fq.seq_.assign(1 << 20, 'C');
+        fq.quality_.assign(1 << 20, '!');
+        OutputArena buf;
+        write_policy<Fastq<> >::write(buf, fq, 10);
+        EXPECT_EQ(buf.size(), 6 + 2 * ((1 << 20) - 10) + 4);
+        buf.appendNumber(1234567890123);
+        EXPECT_EQ(std::string(buf.data() + buf.size() - 13, 13), "1234567890123");
+    }
+
     TEST_F(FastqTest, FastqSequence)
     {
         auto fqiter = reader.begin();
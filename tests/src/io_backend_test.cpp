@@ -0,0 +1,131 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#include <string>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "io_backend.hpp"
+#include "gmock/gmock.h"
+#include "TestData.h"
+
+using namespace std;
+namespace {
+
+std::string readAll(int fd, IoBackendKind kind)
+{
+    AsyncFileSource source(fd, kind);
+    std::string data;
+    std::vector<char> buf(100000);
+    std::streamsize n;
+    while ((n = source.read(buf.data(), buf.size())) > 0) {
+        data.append(buf.data(), n);
+    }
+    return data;
+}
+
+class IoBackendTest : public ::testing::TestWithParam<IoBackendKind>
+{ };
+
+TEST_P(IoBackendTest, SourceMatchesStream)
+{
+    std::ifstream ifs(tests::polyA_Fastq, std::ios::binary);
+    std::stringstream expected;
+    expected << ifs.rdbuf();
+    int fd = open(tests::polyA_Fastq.c_str(), O_RDONLY);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(readAll(fd, GetParam()), expected.str());
+    close(fd);
+}
+
+TEST_P(IoBackendTest, SinkRoundTrip)
+{
+    /* a few buffers' worth, so that writes are in flight while others are filled */
+    std::string data;
+    for (int i = 0; data.size() < (20 << 20); ++i) {
+        data += std::to_string(i) + "\tACGT\n";
+    }
+    char name[] = "/tmp/io_backend_test.XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    {
+        AsyncFileSink sink(fd, GetParam(), true);
+        for (size_t off = 0; off < data.size(); off += 1000003) {
+            sink.write(data.data() + off, std::min<size_t>(1000003, data.size() - off));
+        }
+    }
+    lseek(fd, 0, SEEK_SET);
+    EXPECT_EQ(readAll(fd, GetParam()), data);
+    close(fd);
+    unlink(name);
+}
+
+TEST_P(IoBackendTest, SinkSharesFilePosition)
+{
+    /* stdout and stderr of "> file 2>&1": two fds of the same open file, written in turn */
+    char name[] = "/tmp/io_backend_test.XXXXXX";
+    int fd = mkstemp(name);
+    ASSERT_GE(fd, 0);
+    int other = dup(fd);
+    ASSERT_GE(other, 0);
+    std::string expected;
+    {
+        AsyncFileSink sink(fd, GetParam());
+        for (int i = 0; i < 100; ++i) {
+            std::string out(AsyncFileSink::buffer_size / 3 + i, 'a' + i % 26);
+            std::string log = "log " + std::to_string(i) + "\n";
+            sink.write(out.data(), out.size());
+            if (i % 7 == 0) {
+                struct iovec iov[1] = {{&out[0], 5}};
+                sink.writev(iov, 1);
+                out.append(out.data(), 5);
+            }
+            sink.flush();
+            ASSERT_EQ(::write(other, log.data(), log.size()), ssize_t(log.size()));
+            expected += out + log;
+        }
+    }
+    lseek(fd, 0, SEEK_SET);
+    EXPECT_EQ(readAll(fd, GetParam()), expected);
+    close(other);
+    close(fd);
+    unlink(name);
+}
+
+INSTANTIATE_TEST_CASE_P(Backends, IoBackendTest, ::testing::Values(IoBackendKind::SYNC, IoBackendKind::URING));
+}
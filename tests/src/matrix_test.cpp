@@ -228,6 +228,19 @@ TEST_F(MatrixTest, EqualCompareUsingGeneric2)
     m2(0, 0) = -0.0;
     EXPECT_TRUE(m1 == m2); // calling member-wise comparision
 }
+
+TEST_F(MatrixTest, ReSizeOnlyGrows)
+{
+    Matrix<int> m;
+    m.reSize(2, 100);
+    const int *data = &m(0, 0);
+    m.reSize(2, 10);
+    EXPECT_EQ(m.size(), 20u);
+    EXPECT_EQ(m.capacity(), 200u);
+    EXPECT_EQ(&m(0, 0), data); // not reallocated
+    m.reSize(2, 1000);
+    EXPECT_EQ(m.capacity(), 2000u);
+}
 }
 /*
 int main(int argc, char** argv)
@@ -282,6 +282,13 @@ TEST_F(PolyAHmmModeTest, VirtabiAlgorithm3)
     }
 }
 
+TEST_F(PolyAHmmModeTest, VirtabiAlgorithmEmpty)
+{
+    hmm.calculateVirtabi("AAAAAAC");
+    const Matrix<int>& path = hmm.calculateVirtabi(std::string());
+    EXPECT_EQ(path.size(), 0u);
+}
+
 TEST_F(PolyAHmmModeTest, Posterior1)
 {
     const Matrix<double>& post = hmm.calculatePosterior("AAAAAACAGTCGACGAAAAA");
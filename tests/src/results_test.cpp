@@ -0,0 +1,79 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#include <stdio.h>
+#include <string>
+#include "results.hpp"
+#include "gmock/gmock.h"
+
+namespace {
+
+TEST(ResultsTest, Text)
+{
+    OutputArena out;
+    appendResult(out, std::string("read/1"), 100, 20, false);
+    appendResult(out, std::string("read/2"), 30, 30, false);
+    appendResult(out, std::string("read/3"), 0, 0, false);
+    EXPECT_EQ(std::string(out.data(), out.size()), "read/1\t100\t20\t1\nread/2\t30\t30\t3\nread/3\t0\t0\t0\n");
+}
+
+TEST(ResultsTest, BinaryRoundTrip)
+{
+    OutputArena out;
+    out.append(k_results_magic, k_results_magic_size);
+    appendResult(out, std::string("read/1"), 100000, 0, true);
+    appendResult(out, std::string(""), 7, 7, true);
+    FILE *f = tmpfile();
+    ASSERT_TRUE(f != nullptr);
+    fwrite(out.data(), 1, out.size(), f);
+    rewind(f);
+    char magic[k_results_magic_size];
+    ASSERT_EQ(fread(magic, 1, k_results_magic_size, f), k_results_magic_size);
+    EXPECT_EQ(std::string(magic, k_results_magic_size), std::string(k_results_magic));
+    ReadResult r;
+    ASSERT_TRUE(readResult(f, r));
+    EXPECT_EQ(r.name, "read/1");
+    EXPECT_EQ(r.length, 100000u);
+    EXPECT_EQ(r.polyA_length, 0u);
+    EXPECT_EQ(r.flags, 0u);
+    ASSERT_TRUE(readResult(f, r));
+    EXPECT_EQ(r.name, "");
+    EXPECT_EQ(r.flags, k_result_trimmed | k_result_polyA_only);
+    EXPECT_FALSE(readResult(f, r));
+    fclose(f);
+}
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+
+#include <string>
+#include <vector>
+#include "fastq.hpp"
+#include "shard.hpp"
+#include "gmock/gmock.h"
+#include "TestData.h"
+
+namespace {
+
+TEST(ShardTest, ParseShard)
+{
+    int index, count;
+    ASSERT_TRUE(parseShard("3/8", index, count));
+    EXPECT_EQ(index, 2);
+    EXPECT_EQ(count, 8);
+    EXPECT_FALSE(parseShard("0/8", index, count));
+    EXPECT_FALSE(parseShard("9/8", index, count));
+    EXPECT_FALSE(parseShard("3", index, count));
+    EXPECT_FALSE(parseShard("3/8x", index, count));
+}
+
+TEST(ShardTest, FastqSyncSkipsQualityStartingWithAt)
+{
+    const std::string fq = "AA\n+\n@@\n@b\nCC\n+\n@#\n";
+    EXPECT_EQ(read_policy<Fastq<> >::sync(fq.data(), fq.data() + fq.size(), true), fq.data() + 8);
+    /* the quality "@@" is a name only if followed by a '+' line, which takes more input to tell */
+    EXPECT_EQ(read_policy<Fastq<> >::sync(fq.data(), fq.data() + 10, false), nullptr);
+    EXPECT_EQ(read_policy<Fastq<> >::sync(fq.data() + 12, fq.data() + fq.size(), true), fq.data() + fq.size());
+}
+
+/* all records of the shards of file, read by readers of type Reader, in the order of the shards */
+template<class Reader>
+std::string readShards(const std::string &file, int count, bool bgzf)
+{
+    std::string records, block;
+    for (int i = 0; i < count; ++i) {
+        ShardRange range = bgzf ? bgzfShard<Fastq<> >(file, i, count) : plainShard<Fastq<> >(file, i, count);
+        Reader reader(file, IoBackendKind::SYNC, range);
+        while (reader.template next<Fastq<> >(block, 1000)) {
+            records += block;
+        }
+    }
+    return records;
+}
+
+TEST(ShardTest, ShardsReadEachRecordOnce)
+{
+    std::string whole, block;
+    FormatBlockReader reader(tests::polyA_Fastq);
+    while (reader.next<Fastq<> >(block, 1000)) {
+        whole += block;
+    }
+    for (int count : {1, 2, 3, 7, 100}) {
+        EXPECT_EQ(readShards<FormatBlockReader>(tests::polyA_Fastq, count, false), whole) << count << " shards";
+#ifdef TO_SUPPORT_BAM
+        EXPECT_EQ(readShards<BgzfBlockReader>(tests::polyA_Bgzf_Fastq, count, true), whole) << count << " shards";
+#endif
+    }
+}
+
+TEST(ShardTest, MergeSummaries)
+{
+    const std::string a = tests::Out_Dir + "shard_a.tsv", b = tests::Out_Dir + "shard_b.tsv";
+    std::ofstream(a) << "reads\t10\nreader_seconds\t0.250000\nthreads\t4\npeak_rss_bytes\t300\n";
+    std::ofstream(b) << "reads\t5\nreader_seconds\t0.5\nthreads\t4\npeak_rss_bytes\t200\nnode1_reads\t5\n"
+                        "node1_bases_per_second\t100\n";
+    FILE *out = tmpfile();
+    mergeSummaries({a, b}, out);
+    rewind(out);
+    char merged[256] = {0};
+    fread(merged, 1, sizeof(merged) - 1, out);
+    fclose(out);
+    EXPECT_STREQ(merged, "reads\t15\nreader_seconds\t0.750000\npeak_rss_bytes\t300\nnode1_reads\t5\n");
+}
+
+}
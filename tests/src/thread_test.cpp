@@ -0,0 +1,194 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+// Author: Bo Han
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "thread.hpp"
+#include "gmock/gmock.h"
+
+namespace {
+
+TEST(SpscRingTest, FullAndEmpty)
+{
+    SpscRing<int, 2> ring;
+    int v = 1;
+    EXPECT_FALSE(ring.pop(v));
+    EXPECT_TRUE(ring.push(v));
+    v = 2;
+    EXPECT_TRUE(ring.push(v));
+    v = 3;
+    EXPECT_FALSE(ring.push(v));
+    EXPECT_EQ(v, 3);
+    ASSERT_TRUE(ring.pop(v));
+    EXPECT_EQ(v, 1);
+    ASSERT_TRUE(ring.pop(v));
+    EXPECT_EQ(v, 2);
+    EXPECT_FALSE(ring.pop(v));
+}
+
+TEST(SpscRingTest, KeepsOrderAcrossThreads)
+{
+    SpscRing<std::unique_ptr<int>, 4> ring;
+    Doorbell space;
+    const int n = 10000;
+    std::thread producer([&]() {
+        for (int i = 0; i < n; ++i) {
+            std::unique_ptr<int> v(new int(i));
+            while (!ring.push(v)) {
+                space.wait();
+            }
+        }
+    });
+    std::vector<int> got;
+    std::unique_ptr<int> v;
+    while (static_cast<int>(got.size()) < n) {
+        if (ring.pop(v)) {
+            got.push_back(*v);
+            space.ring();
+        }
+    }
+    producer.join();
+    for (int i = 0; i < n; ++i) {
+        ASSERT_EQ(got[i], i);
+    }
+}
+
+TEST(MpmcRingTest, EveryValueOnce)
+{
+    MpmcRing<int, 8> ring;
+    const int n = 10000;
+    std::atomic<int> popped{0};
+    std::vector<std::thread> threads;
+    std::vector<std::vector<int> > got(2);
+    for (int p = 0; p < 2; ++p) {
+        threads.emplace_back([&ring, p]() {
+            for (int i = p; i < n; i += 2) {
+                int v = i;
+                while (!ring.push(v)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&ring, &popped, &got, p]() {
+            int v;
+            while (popped.load() < n) {
+                if (ring.pop(v)) {
+                    got[p].push_back(v);
+                    ++popped;
+                }
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    std::vector<int> all(got[0]);
+    all.insert(all.end(), got[1].begin(), got[1].end());
+    std::sort(all.begin(), all.end());
+    ASSERT_EQ(static_cast<int>(all.size()), n);
+    for (int i = 0; i < n; ++i) {
+        ASSERT_EQ(all[i], i);
+    }
+}
+
+TEST(MemoryBudgetTest, SpentUntilReleased)
+{
+    MemoryBudget budget(100);
+    budget.charge(60);
+    EXPECT_FALSE(budget.spent());
+    budget.charge(60);
+    EXPECT_TRUE(budget.spent());
+    std::thread release([&budget]() { budget.release(60); });
+    budget.wait();
+    release.join();
+    EXPECT_FALSE(budget.spent());
+    EXPECT_EQ(budget.peak(), 120u);
+    MemoryBudget unlimited;
+    unlimited.charge(1ull << 40);
+    EXPECT_FALSE(unlimited.spent());
+}
+
+TEST(MemoryBudgetTest, KeptMemoryDoesNotWait)
+{
+    MemoryBudget budget(100);
+    budget.keep(150);
+    EXPECT_FALSE(budget.spent()); /* nothing in flight would give memory back */
+    EXPECT_FALSE(budget.fits(1));
+    budget.charge(10);
+    EXPECT_TRUE(budget.spent());
+    budget.release(10);
+    budget.unkeep(100);
+    EXPECT_TRUE(budget.fits(50));
+    EXPECT_FALSE(budget.fits(51));
+    EXPECT_EQ(budget.peak(), 160u);
+}
+
+TEST(StagePoolTest, RunsEveryTaskBeforeWaitReturns)
+{
+    for (int threads : {0, 3}) {
+        StagePool pool(threads);
+        std::vector<int> done(1000, 0);
+        TaskGroup group;
+        for (size_t i = 0; i < done.size(); ++i) {
+            pool.submit(group, [&done, i]() { done[i] += 1; });
+        }
+        pool.wait(group);
+        EXPECT_EQ(std::count(done.begin(), done.end(), 1), 1000);
+    }
+}
+
+TEST(BatchSizerTest, AdaptsToCost)
+{
+    BatchSizer fixed(5000, false);
+    fixed.record(30000, 10000, 1.0, 0.0);
+    EXPECT_EQ(fixed.bases(), 5000u);
+    EXPECT_EQ(fixed.bytes(), 15000u);
+
+    BatchSizer sizer(5000, true);
+    /* 1 us a base and 100 us to get a batch: 10 ms batches, i.e. 10000 bases */
+    sizer.record(20000, 10000, 0.01, 0.0001);
+    EXPECT_EQ(sizer.bases(), 10000u);
+    EXPECT_EQ(sizer.bytes(), 20000u);
+    /* cheap to get: no shorter than BatchSizer::min_seconds */
+    BatchSizer cheap(5000, true);
+    cheap.record(10000, 10000, 0.01, 0.0);
+    EXPECT_EQ(cheap.bases(), 1000u);
+}
+}
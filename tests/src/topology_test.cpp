@@ -0,0 +1,106 @@
+// Copyright (c) 2015, Pacific Biosciences of California, Inc.
+//
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted (subject to the limitations in the
+// disclaimer below) provided that the following conditions are met:
+//
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above
+//    copyright notice, this list of conditions and the following
+//    disclaimer in the documentation and/or other materials provided
+//    with the distribution.
+//
+//  * Neither the name of Pacific Biosciences nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// NO EXPRESS OR IMPLIED LICENSES TO ANY PARTY'S PATENT RIGHTS ARE
+// GRANTED BY THIS LICENSE. THIS SOFTWARE IS PROVIDED BY PACIFIC
+// BIOSCIENCES AND ITS CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+// WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL PACIFIC BIOSCIENCES OR ITS
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+// USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+// OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+// SUCH DAMAGE.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "topology.hpp"
+#include "gmock/gmock.h"
+
+namespace {
+
+TEST(TopologyTest, ParseCpuList)
+{
+    EXPECT_EQ(parseCpuList("0-3,8,10-11\n"), std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+    EXPECT_EQ(parseCpuList("5"), std::vector<int>({5}));
+    EXPECT_TRUE(parseCpuList("").empty());
+}
+
+TEST(TopologyTest, PinningOrderFillsOneNodeFirst)
+{
+    std::vector<int> nodes = {0, 1, 0, 1, 0, 1}; /* hyperthreads interleaved across two sockets */
+    EXPECT_EQ(pinningOrder({0, 1, 2, 3, 4, 5}, nodes), std::vector<int>({0, 2, 4, 1, 3, 5}));
+    EXPECT_EQ(pinningOrder({1, 9}, nodes), std::vector<int>({9, 1})); /* cpus sysfs does not know are on node 0 */
+}
+
+TEST(TopologyTest, ParseCpuMax)
+{
+    EXPECT_EQ(parseCpuMax("max 100000\n"), 0);
+    EXPECT_EQ(parseCpuMax("250000 100000\n"), 2.5);
+    EXPECT_EQ(parseCpuMax(""), 0);
+}
+
+/* write line to file, making the directories of it under the existing dir; each path made is added to made */
+void writeFile(const std::string& dir, const std::string& file, const std::string& line, std::vector<std::string>& made)
+{
+    for (size_t slash = file.find('/'); slash != std::string::npos; slash = file.find('/', slash + 1)) {
+        if (mkdir((dir + "/" + file.substr(0, slash)).c_str(), 0700) == 0)
+            made.push_back(dir + "/" + file.substr(0, slash));
+    }
+    FILE *f = fopen((dir + "/" + file).c_str(), "w");
+    ASSERT_TRUE(f != nullptr);
+    fputs(line.c_str(), f);
+    fclose(f);
+    made.push_back(dir + "/" + file);
+}
+
+TEST(TopologyTest, CgroupCpuLimit)
+{
+    char name[] = "/tmp/topology_test.XXXXXX";
+    ASSERT_TRUE(mkdtemp(name) != nullptr);
+    const std::string dir(name);
+    std::vector<std::string> made;
+    /* v2: the tightest of the group and its parents */
+    writeFile(dir, "v2/self", "0::/a/b\n", made);
+    writeFile(dir, "v2/a/cpu.max", "200000 100000\n", made);
+    writeFile(dir, "v2/a/b/cpu.max", "max 100000\n", made);
+    EXPECT_EQ(cgroupCpuLimit(dir + "/v2", dir + "/v2/self"), 2);
+    /* v1: the group of the cpu controller, not the root of its hierarchy */
+    writeFile(dir, "v1/self", "5:memory:/slurm/job1\n4:cpu,cpuacct:/slurm/job1\n", made);
+    writeFile(dir, "v1/cpu,cpuacct/cpu.cfs_quota_us", "-1\n", made);
+    writeFile(dir, "v1/cpu,cpuacct/cpu.cfs_period_us", "100000\n", made);
+    writeFile(dir, "v1/cpu,cpuacct/slurm/job1/cpu.cfs_quota_us", "150000\n", made);
+    writeFile(dir, "v1/cpu,cpuacct/slurm/job1/cpu.cfs_period_us", "100000\n", made);
+    EXPECT_EQ(cgroupCpuLimit(dir + "/v1", dir + "/v1/self"), 1.5);
+    EXPECT_EQ(cgroupCpuLimit(dir + "/v1", dir + "/none"), 0);
+    for (auto it = made.rbegin(); it != made.rend(); ++it)
+        remove(it->c_str());
+    rmdir(name);
+}
+
+}